@@ -0,0 +1,78 @@
+#include "sys.h"
+#include "Arena.h"
+#include "Thread.h"
+#include "debug.h"
+#include <algorithm>
+
+namespace thread_permuter {
+
+//static
+Arena* Arena::s_routed;
+//static
+bool Arena::s_suspended;
+
+Arena::~Arena()
+{
+  if (s_routed == this)
+    s_routed = nullptr;
+  while (m_first)
+  {
+    Chunk* next = m_first->m_next;
+    std::free(m_first);
+    m_first = next;
+  }
+}
+
+void* Arena::allocate_from_next_chunk(size_t size, size_t alignment)
+{
+  // The chunks are allocated with malloc, not with operator new, because that might be routed to this arena.
+  size_t const needed = size + alignment;
+  Chunk* next = m_current ? m_current->m_next : m_first;
+  if (!next || next->m_size < needed)
+  {
+    // Insert a new chunk after the current one; a chunk that is too small is used for the allocations after this one.
+    size_t const chunk_size = std::max(m_chunk_size, needed);
+    Chunk* chunk = static_cast<Chunk*>(std::malloc(sizeof(Chunk) + chunk_size));
+    if (!chunk)
+      throw std::bad_alloc();
+    chunk->m_size = chunk_size;
+    chunk->m_next = next;
+    if (m_current)
+      m_current->m_next = chunk;
+    else
+      m_first = chunk;
+    m_capacity += chunk_size;
+    Dout(dc::permutation, "Arena grew to " << m_capacity << " bytes.");
+    next = chunk;
+  }
+  m_current = next;
+  m_free = next->data();
+  m_end = m_free + next->m_size;
+  return allocate(size, alignment);
+}
+
+void Arena::reset()
+{
+  m_current = nullptr;
+  m_free = m_end = nullptr;
+}
+
+bool Arena::contains(void const* ptr) const
+{
+  char const* p = static_cast<char const*>(ptr);
+  for (Chunk* chunk = m_first; chunk; chunk = chunk->m_next)
+    if (p >= chunk->data() && p < chunk->data() + chunk->m_size)
+      return true;
+  return false;
+}
+
+//static
+void* Arena::routed_new(size_t size, size_t alignment)
+{
+  // Only the test functions allocate from the arena, not the engine or the callbacks.
+  if (!s_routed || s_suspended || !Thread::current())
+    return nullptr;
+  return s_routed->allocate(size, alignment);
+}
+
+} // namespace thread_permuter
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace thread_permuter {
+
+// Memory for test fixtures that only has to live for a single permutation.
+//
+// Allocating is bumping a pointer; nothing is freed individually. Instead ThreadPermuter
+// calls reset() before every on_permutation_begin, which makes all memory available again
+// without returning it to malloc. After the first few permutations no more chunks are
+// needed and allocating doesn't touch malloc anymore.
+//
+// Destructors are not called by reset(): objects in the arena must not own anything outside of it.
+class Arena
+{
+ public:
+  static constexpr size_t default_chunk_size = 64 * 1024;
+
+ private:
+  struct Chunk
+  {
+    Chunk* m_next;              // The next chunk, or nullptr if this is the last one.
+    size_t m_size;              // The number of bytes that can be allocated from this chunk.
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  size_t m_chunk_size;          // The size of new chunks (unless an allocation needs more).
+  Chunk* m_first;               // The first chunk, or nullptr if nothing was allocated yet.
+  Chunk* m_current;             // The chunk that is allocated from.
+  char* m_free;                 // The first unused byte of m_current.
+  char* m_end;                  // One past the last byte of m_current.
+  size_t m_capacity;            // The total size of all chunks.
+
+  static Arena* s_routed;       // The arena that operator new of the test functions allocates from (see TP_ARENA_OPERATOR_NEW).
+  static bool s_suspended;      // Set while the engine allocates memory on behalf of a test function.
+
+ public:
+  Arena(size_t chunk_size = default_chunk_size) :
+    m_chunk_size(chunk_size), m_first(nullptr), m_current(nullptr), m_free(nullptr), m_end(nullptr), m_capacity(0) { }
+  ~Arena();
+
+  Arena(Arena const&) = delete;
+  Arena& operator=(Arena const&) = delete;
+
+  // Return size bytes aligned to alignment (a power of two).
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+  {
+    if (!m_free)
+      return allocate_from_next_chunk(size, alignment);
+    char* ptr = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(m_free) + alignment - 1) & ~(alignment - 1));
+    if (ptr + size > m_end)
+      return allocate_from_next_chunk(size, alignment);
+    m_free = ptr + size;
+    return ptr;
+  }
+
+  // Construct a T in the arena.
+  template<typename T, typename... Args>
+  T* create(Args&&... args) { return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...); }
+
+  // Make all memory available again. Called by ThreadPermuter before every permutation.
+  void reset();
+
+  // Return true if ptr was allocated from this arena.
+  bool contains(void const* ptr) const;
+
+  // The total size of the chunks that were allocated from malloc.
+  size_t capacity() const { return m_capacity; }
+
+  // Let operator new of the test functions allocate from arena (or stop doing that when arena is nullptr).
+  // This only has effect when TP_ARENA_OPERATOR_NEW is used.
+  static void route_operator_new(Arena* arena) { s_routed = arena; }
+
+  // While an object of this type exists, operator new isn't routed to the arena. Used by the engine
+  // when it is called from a test function and allocates memory that must survive the permutation.
+  class Unrouted
+  {
+   private:
+    bool m_suspended;
+
+   public:
+    Unrouted() : m_suspended(s_suspended) { s_suspended = true; }
+    ~Unrouted() { s_suspended = m_suspended; }
+  };
+
+  // Used by TP_ARENA_OPERATOR_NEW.
+  // Return memory from the routed arena if called from a test function, or nullptr otherwise.
+  static void* routed_new(size_t size, size_t alignment);
+  // Return true if ptr belongs to the routed arena (and thus must not be freed).
+  static bool routed_delete(void* ptr) { return s_routed && s_routed->contains(ptr); }
+
+ private:
+  void* allocate_from_next_chunk(size_t size, size_t alignment);
+};
+
+// A standard allocator that allocates from an Arena; deallocate does nothing.
+template<typename T>
+class ArenaAllocator
+{
+ private:
+  Arena* m_arena;
+
+  template<typename U> friend class ArenaAllocator;
+
+ public:
+  using value_type = T;
+
+  ArenaAllocator(Arena& arena) : m_arena(&arena) { }
+  template<typename U>
+  ArenaAllocator(ArenaAllocator<U> const& other) : m_arena(other.m_arena) { }
+
+  T* allocate(size_t n) { return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T))); }
+  void deallocate(T*, size_t) { }
+
+  template<typename U>
+  bool operator==(ArenaAllocator<U> const& other) const { return m_arena == other.m_arena; }
+};
+
+} // namespace thread_permuter
+
+// Put this once at namespace scope in a source file of the test program to replace the global
+// operator new and delete: then, while ThreadPermuter::set_arena_operator_new(true) is in effect,
+// memory that the test functions allocate comes from ThreadPermuter::arena() and deleting it does nothing.
+// Memory allocated by a test function must therefore not be used after its permutation ended.
+#define TP_ARENA_OPERATOR_NEW \
+  void* operator new(std::size_t size) \
+  { \
+    if (void* ptr = thread_permuter::Arena::routed_new(size, alignof(std::max_align_t))) \
+      return ptr; \
+    if (void* ptr = std::malloc(size ? size : 1)) \
+      return ptr; \
+    throw std::bad_alloc(); \
+  } \
+  void* operator new(std::size_t size, std::align_val_t alignment) \
+  { \
+    if (void* ptr = thread_permuter::Arena::routed_new(size, static_cast<std::size_t>(alignment))) \
+      return ptr; \
+    std::size_t const a = static_cast<std::size_t>(alignment); \
+    if (void* ptr = std::aligned_alloc(a, (size + a - 1) / a * a)) \
+      return ptr; \
+    throw std::bad_alloc(); \
+  } \
+  void operator delete(void* ptr) noexcept \
+  { \
+    if (!thread_permuter::Arena::routed_delete(ptr)) \
+      std::free(ptr); \
+  } \
+  void operator delete(void* ptr, std::align_val_t) noexcept \
+  { \
+    if (!thread_permuter::Arena::routed_delete(ptr)) \
+      std::free(ptr); \
+  }
@@ -0,0 +1,104 @@
+#include "sys.h"
+#include "CheckpointSite.h"
+#include "Arena.h"
+#include "debug.h"
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+namespace thread_permuter {
+
+namespace {
+
+// The table of all sites; sites are added by their constructor and never removed.
+struct Registry
+{
+  std::mutex m_mutex;
+  std::vector<CheckpointSite const*> m_sites;
+  std::map<std::tuple<char const*, char const*, int>, std::unique_ptr<CheckpointSite>> m_run_time_sites;      // The sites created by lookup().
+};
+
+Registry& registry()
+{
+  static Registry registry;
+  return registry;
+}
+
+} // namespace
+
+CheckpointSite::CheckpointSite(char const* kind, char const* file, int line) :
+  m_kind(kind), m_file(file), m_line(line), m_visits(0), m_branches(0), m_permutations(0)
+{
+  Arena::Unrouted unrouted;     // The registry outlives the permutation.
+  Registry& r(registry());
+  std::lock_guard<std::mutex> lock(r.m_mutex);
+  m_id = r.m_sites.size();
+  r.m_sites.push_back(this);
+}
+
+//static
+CheckpointSite const& CheckpointSite::test_entry()
+{
+  static CheckpointSite const site("begin or end", "<test function>", 0);
+  return site;
+}
+
+//static
+CheckpointSite const& CheckpointSite::lookup(char const* kind, char const* file, int line)
+{
+  Arena::Unrouted unrouted;
+  Registry& r(registry());
+  std::unique_lock<std::mutex> lock(r.m_mutex);
+  // The strings of a std::source_location are string literals, so it is enough to compare their addresses.
+  auto key = std::make_tuple(kind, file, line);
+  auto iter = r.m_run_time_sites.find(key);
+  if (iter != r.m_run_time_sites.end())
+    return *iter->second;
+  lock.unlock();        // The constructor locks the mutex too.
+  std::unique_ptr<CheckpointSite> site(new CheckpointSite(kind, file, line));
+  lock.lock();
+  return *r.m_run_time_sites.emplace(std::move(key), std::move(site)).first->second;
+}
+
+//static
+size_t CheckpointSite::number_of_sites()
+{
+  Registry& r(registry());
+  std::lock_guard<std::mutex> lock(r.m_mutex);
+  return r.m_sites.size();
+}
+
+//static
+void CheckpointSite::reset_statistics()
+{
+  Registry& r(registry());
+  std::lock_guard<std::mutex> lock(r.m_mutex);
+  for (CheckpointSite const* site : r.m_sites)
+    site->m_visits = site->m_branches = site->m_permutations = 0;
+}
+
+//static
+void CheckpointSite::print_statistics(std::ostream& os)
+{
+  Registry& r(registry());
+  std::vector<CheckpointSite const*> sites;
+  {
+    std::lock_guard<std::mutex> lock(r.m_mutex);
+    for (CheckpointSite const* site : r.m_sites)
+      if (site->m_visits > 0)
+        sites.push_back(site);
+  }
+  std::sort(sites.begin(), sites.end(), [](CheckpointSite const* a, CheckpointSite const* b){
+      return a->m_permutations != b->m_permutations ? a->m_permutations > b->m_permutations : a->m_branches > b->m_branches; });
+  os << std::setw(14) << "permutations" << std::setw(14) << "branches" << std::setw(14) << "visits" << "  checkpoint\n";
+  for (CheckpointSite const* site : sites)
+    os << std::setw(14) << site->m_permutations << std::setw(14) << site->m_branches << std::setw(14) << site->m_visits <<
+      "  " << site->m_kind << " at " << site->m_file << ':' << site->m_line << '\n';
+}
+
+} // namespace thread_permuter
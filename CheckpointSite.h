@@ -0,0 +1,62 @@
+#pragma once
+
+#include <iosfwd>
+#include <cstddef>
+
+namespace thread_permuter {
+
+// A place in the source code where a test thread can be paused (TPY, TPB, Mutex::lock, etc).
+//
+// Every checkpoint macro defines a static CheckpointSite (see TP_CHECKPOINT_SITE), that adds itself
+// to a global table the first time the checkpoint is reached. Thread keeps a pointer to the site that
+// it is paused at, and Permutation counts per site how the search tree grows at it.
+class CheckpointSite
+{
+ private:
+  char const* m_kind;                   // The name of the macro or function, for example "TPY".
+  char const* m_file;                   // The source file of the checkpoint.
+  int m_line;                           // The line number of the checkpoint.
+  int m_id;                             // The index of this site in the global table.
+  mutable long m_visits;                // The number of times that the next step was chosen after this checkpoint.
+  mutable long m_branches;              // The number of those at which more than one thread could run.
+  mutable long m_permutations;          // The number of permutations that branched off at this checkpoint.
+
+ public:
+  CheckpointSite(char const* kind, char const* file, int line);
+  CheckpointSite(CheckpointSite const&) = delete;
+
+  char const* kind() const { return m_kind; }
+  char const* file() const { return m_file; }
+  int line() const { return m_line; }
+  int id() const { return m_id; }
+
+  // Called by Permutation::step for the checkpoint at which the previous step ended.
+  // branch_point is true when more than one thread could run and new_permutation is true when
+  // this is the step that the last call to Permutation::next() changed.
+  void count_step(bool branch_point, bool new_permutation) const
+  {
+    ++m_visits;
+    if (branch_point)
+      ++m_branches;
+    if (new_permutation)
+      ++m_permutations;
+  }
+
+  // The site of a thread that didn't reach its first checkpoint yet, or that finished.
+  static CheckpointSite const& test_entry();
+  // The site for a checkpoint whose location is only known at run time (for example, from a std::source_location).
+  static CheckpointSite const& lookup(char const* kind, char const* file, int line);
+  // The number of registered sites.
+  static size_t number_of_sites();
+
+  // Reset the statistics of all sites.
+  static void reset_statistics();
+  // Print the statistics of every site that was visited, those that created the most permutations first.
+  static void print_statistics(std::ostream& os);
+};
+
+} // namespace thread_permuter
+
+// Return a reference to a CheckpointSite for the current source location, that is created the first time it is used.
+#define TP_CHECKPOINT_SITE(kind) \
+  ([]() -> thread_permuter::CheckpointSite const& { static thread_permuter::CheckpointSite const site(kind, __FILE__, __LINE__); return site; }())
@@ -11,36 +11,54 @@ ConditionVariable::ConditionVariable() : m_waiting_threads{0}, m_was_notify_one{
 
 void ConditionVariable::wait(std::unique_lock<Mutex>& lock)
 {
+  Thread::touch(this, true);
   m_waiting_threads |= index2mask(Thread::current()->get_thi());
   DoutEntering(dc::notice|flush_cf, "ConditionVariable::wait() [" << (void*)this << "]; there are now " <<
       m_waiting_threads.count() << " threads waiting on " << (void*)this << " (" << m_waiting_threads << ")");
   lock.unlock();
-  Thread::wait(this);
-  lock.lock();
-  if (m_was_notify_one)
+  Thread::checkpoint(TP_CHECKPOINT_SITE("ConditionVariable::wait"));
+  try
   {
-    ASSERT(m_was_notify_one == 1);
-    --m_was_notify_one;
-    Thread::woken(this);  // Recover from what Thread::notify_one(this) did.
+    Thread::wait(this);
+    lock.lock();
+    if (m_was_notify_one)
+    {
+      ASSERT(m_was_notify_one == 1);
+      --m_was_notify_one;
+      Thread::checkpoint(TP_CHECKPOINT_SITE("ConditionVariable::wait"));
+      Thread::woken(this);  // Recover from what Thread::notify_one(this) did.
+    }
+  }
+  catch (Thread::Abandoned const&)
+  {
+    // This thread was dead locked; it no longer waits, and a notify_one that woke it ends with the permutation.
+    m_waiting_threads &= ~index2mask(Thread::current()->get_thi());
+    m_was_notify_one = 0;
+    throw;
   }
   m_waiting_threads &= ~index2mask(Thread::current()->get_thi());
   Dout(dc::notice|flush_cf, "Leaving ConditionVariable::wait; there are now " << m_waiting_threads.count() <<
       " threads waiting on " << (void*)this << " (" << m_waiting_threads << ")");
 }
 
-void ConditionVariable::notify_one() noexcept
+void ConditionVariable::notify_one()
 {
   DoutEntering(dc::notice, "ConditionVariable::notify_one() [" << (void*)this << "]");
+  Thread::touch(this, true);
   if (m_waiting_threads.any())
   {
-    Thread::notify_one(this);
+    Thread::checkpoint(TP_CHECKPOINT_SITE("ConditionVariable::notify_one"));
+    // The woken thread runs during the pause of Thread::notify_one, so count it right before that.
     ++m_was_notify_one;
+    Thread::notify_one(this);
   }
 }
 
-void ConditionVariable::notify_all() noexcept
+void ConditionVariable::notify_all()
 {
   DoutEntering(dc::notice, "ConditionVariable::notify_all() [" << (void*)this << "]");
+  Thread::touch(this, true);
+  Thread::checkpoint(TP_CHECKPOINT_SITE("ConditionVariable::notify_all"));
   Thread::notify_all(this);
 }
 
@@ -15,8 +15,8 @@ class ConditionVariable
   ConditionVariable();
 
   void wait(std::unique_lock<Mutex>& lock);
-  void notify_one() noexcept;
-  void notify_all() noexcept;
+  void notify_one();
+  void notify_all();
   void clear_waiting_threads();
 
   threads_set_type waiting_threads() const { return m_waiting_threads; }
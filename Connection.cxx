@@ -0,0 +1,163 @@
+#include "sys.h"
+#include "Connection.h"
+#include "debug.h"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace thread_permuter {
+
+namespace {
+
+// Split address into a host and port; returns false if it is a Unix domain socket path.
+bool parse_tcp_address(std::string const& address, std::string& host, std::string& port)
+{
+  if (address.compare(0, 5, "unix:") == 0)
+    return false;
+  size_t colon = address.rfind(':');
+  host = colon == std::string::npos ? std::string() : address.substr(0, colon);
+  port = colon == std::string::npos ? address : address.substr(colon + 1);
+  return true;
+}
+
+bool make_unix_address(std::string const& address, sockaddr_un& sun)
+{
+  std::string const path = address.substr(5);
+  std::memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(sun.sun_path))
+    return false;
+  std::strcpy(sun.sun_path, path.c_str());
+  return true;
+}
+
+int open_socket(std::string const& address, bool listening)
+{
+  std::string host, port;
+  if (!parse_tcp_address(address, host, port))
+  {
+    sockaddr_un sun;
+    if (!make_unix_address(address, sun))
+      return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+      return -1;
+    if (listening)
+      unlink(sun.sun_path);
+    int res = listening ? bind(fd, reinterpret_cast<sockaddr*>(&sun), sizeof(sun)) : ::connect(fd, reinterpret_cast<sockaddr*>(&sun), sizeof(sun));
+    if (res == -1 || (listening && ::listen(fd, SOMAXCONN) == -1))
+    {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (listening)
+    hints.ai_flags = AI_PASSIVE;
+  addrinfo* result;
+  if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0)
+    return -1;
+  int fd = -1;
+  for (addrinfo* ai = result; ai; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd == -1)
+      continue;
+    if (listening)
+    {
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0)
+        break;
+    }
+    else if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  return fd;
+}
+
+} // namespace
+
+Connection& Connection::operator=(Connection&& orig)
+{
+  if (m_fd != -1)
+    close(m_fd);
+  m_fd = orig.m_fd;
+  m_input = std::move(orig.m_input);
+  orig.m_fd = -1;
+  return *this;
+}
+
+Connection::~Connection()
+{
+  if (m_fd != -1)
+    close(m_fd);
+}
+
+//static
+Connection Connection::connect(std::string const& address)
+{
+  return open_socket(address, false);
+}
+
+//static
+int Connection::listen(std::string const& address)
+{
+  return open_socket(address, true);
+}
+
+bool Connection::send(std::string const& line)
+{
+  std::string const data = line + '\n';
+  size_t sent = 0;
+  while (sent < data.size())
+  {
+    ssize_t len = ::send(m_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (len == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      Dout(dc::warning|error_cf, "send");
+      return false;
+    }
+    sent += len;
+  }
+  return true;
+}
+
+int Connection::read_line(std::string& line, bool block)
+{
+  for (;;)
+  {
+    size_t const new_line = m_input.find('\n');
+    if (new_line != std::string::npos)
+    {
+      line = m_input.substr(0, new_line);
+      m_input.erase(0, new_line + 1);
+      return 1;
+    }
+    char buf[4096];
+    ssize_t len = recv(m_fd, buf, sizeof(buf), block ? 0 : MSG_DONTWAIT);
+    if (len > 0)
+      m_input.append(buf, len);
+    else if (len == 0)
+      return -1;
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return 0;
+    else if (errno != EINTR)
+      return -1;
+  }
+}
+
+} // namespace thread_permuter
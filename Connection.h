@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+
+namespace thread_permuter {
+
+// A line based stream connection, used between a Coordinator and its workers.
+//
+// An address is either "unix:" followed by the path of a Unix domain socket,
+// or "host:port" for TCP (an empty host means any address when listening).
+class Connection
+{
+ private:
+  int m_fd;                     // The socket, or -1.
+  std::string m_input;          // Received data that does not form a complete line yet.
+
+ public:
+  Connection(int fd = -1) : m_fd(fd) { }
+  Connection(Connection&& orig) : m_fd(orig.m_fd), m_input(std::move(orig.m_input)) { orig.m_fd = -1; }
+  Connection& operator=(Connection&& orig);
+  ~Connection();
+
+  // Connect to a listening socket. Returns a Connection with fd() == -1 on failure.
+  static Connection connect(std::string const& address);
+  // Create a socket that listens on address. Returns -1 on failure.
+  static int listen(std::string const& address);
+
+  int fd() const { return m_fd; }
+
+  // Send line, followed by a new-line. Returns false on failure.
+  bool send(std::string const& line);
+
+  // Read the next line (without the new-line). If block is false and there is no
+  // complete line available yet, returns 0. Returns 1 on success and -1 when the
+  // connection was closed.
+  int read_line(std::string& line, bool block);
+};
+
+} // namespace thread_permuter
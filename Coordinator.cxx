@@ -0,0 +1,204 @@
+#include "sys.h"
+#include "Coordinator.h"
+#include "Thread.h"
+#include "debug.h"
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+namespace thread_permuter {
+
+Coordinator::Coordinator(std::string const& address) :
+  m_address(address), m_changes(0), m_number_of_permutations(0), m_number_of_redundant_permutations(0), m_number_of_reassigned_prefixes(0)
+{
+  m_listen_fd = Connection::listen(address);
+  if (m_listen_fd == -1)
+    DoutFatal(dc::core|error_cf, "Could not listen on \"" << address << "\"");
+}
+
+Coordinator::~Coordinator()
+{
+  close(m_listen_fd);
+  if (m_address.compare(0, 5, "unix:") == 0)
+    unlink(m_address.c_str() + 5);
+}
+
+void Coordinator::process(Worker& worker, std::string const& message)
+{
+  Dout(dc::notice, "Worker " << worker.m_connection.fd() << ": " << message);
+  if (message == "READY")
+    worker.m_idle = true;
+  else if (message.compare(0, 5, "DONE ") == 0)
+  {
+    std::istringstream iss(message.substr(5));
+    int permutations, redundant;
+    iss >> permutations >> redundant;
+    m_number_of_permutations += permutations;
+    m_number_of_redundant_permutations += redundant;
+    m_failures.insert(m_failures.end(), worker.m_failures.begin(), worker.m_failures.end());
+    worker.m_failures.clear();
+    worker.m_busy = false;
+    worker.m_idle = true;
+  }
+  else if (message.compare(0, 5, "FAIL ") == 0)
+    worker.m_failures.push_back(message.substr(5));
+  else if (message.compare(0, 6, "SPLIT ") == 0)
+  {
+    m_frontier.push_back(message.substr(6));
+    ++m_changes;
+  }
+  else if (message.compare(0, 6, "STOLEN") == 0)
+  {
+    worker.m_steal_sent = false;
+    if (message.size() == 6)
+    {
+      // Nothing could be given away; don't ask again right away.
+      worker.m_steal_refused = m_changes;
+      worker.m_steal_refused_time = std::chrono::steady_clock::now();
+    }
+    else
+    {
+      worker.m_steal_refused = -1;
+      // The worker gave away subtrees and continues with a longer prefix.
+      // What it did outside of that prefix won't be explored again, even if it disconnects.
+      std::istringstream iss(message.substr(7));
+      int permutations, redundant;
+      std::string prefix;
+      iss >> permutations >> redundant >> prefix;
+      m_number_of_permutations += permutations;
+      m_number_of_redundant_permutations += redundant;
+      worker.m_prefix = prefix;
+      auto inside = std::stable_partition(worker.m_failures.begin(), worker.m_failures.end(),
+          [&prefix](std::string const& failure){ return failure.compare(0, prefix.size(), prefix) != 0; });
+      m_failures.insert(m_failures.end(), worker.m_failures.begin(), inside);
+      worker.m_failures.erase(worker.m_failures.begin(), inside);
+    }
+  }
+  else
+    Dout(dc::warning, "Ignoring unknown message \"" << message << "\".");
+}
+
+void Coordinator::run()
+{
+  DoutEntering(dc::notice, "Coordinator::run()");
+  m_frontier.assign(1, std::string());
+  m_unexplored_prefixes.clear();
+  bool started = false;
+  for (;;)
+  {
+    // Hand out work to idle workers.
+    int number_of_busy_workers = 0;
+    bool have_idle_workers = false;
+    for (Worker& worker : m_workers)
+    {
+      if (worker.m_idle && !m_frontier.empty())
+      {
+        worker.m_prefix = m_frontier.front();
+        m_frontier.pop_front();
+        worker.m_connection.send("WORK " + worker.m_prefix);
+        worker.m_steal_refused = -1;
+        worker.m_idle = false;
+        worker.m_busy = true;
+        started = true;
+      }
+      if (worker.m_busy)
+        ++number_of_busy_workers;
+      have_idle_workers |= worker.m_idle;
+    }
+    if (started && number_of_busy_workers == 0 && m_frontier.empty())
+      break;
+    // Without workers the frontier can't be served anymore.
+    if (started && m_workers.empty())
+    {
+      Dout(dc::warning, "All workers disconnected; " << m_frontier.size() << " prefixes were not explored.");
+      m_unexplored_prefixes.insert(m_unexplored_prefixes.end(), m_frontier.begin(), m_frontier.end());
+      m_frontier.clear();
+      break;
+    }
+    // Ask the busy workers to give away part of their work.
+    int timeout = -1;
+    if (have_idle_workers && m_frontier.empty())
+    {
+      auto const now = std::chrono::steady_clock::now();
+      for (Worker& worker : m_workers)
+      {
+        if (!worker.m_busy || worker.m_steal_sent)
+          continue;
+        if (worker.m_steal_refused == m_changes && now < worker.m_steal_refused_time + steal_backoff)
+        {
+          // Wake up when the backoff of this worker ends.
+          int const remaining = std::chrono::ceil<std::chrono::milliseconds>(worker.m_steal_refused_time + steal_backoff - now).count();
+          timeout = timeout == -1 ? remaining : std::min(timeout, remaining);
+          continue;
+        }
+        worker.m_connection.send("STEAL");
+        worker.m_steal_sent = true;
+      }
+    }
+
+    std::vector<pollfd> fds(1 + m_workers.size());
+    fds[0] = { m_listen_fd, POLLIN, 0 };
+    for (size_t w = 0; w < m_workers.size(); ++w)
+      fds[w + 1] = { m_workers[w].m_connection.fd(), POLLIN, 0 };
+    if (poll(fds.data(), fds.size(), timeout) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      DoutFatal(dc::core|error_cf, "poll");
+    }
+
+    for (size_t w = m_workers.size(); w > 0; --w)
+    {
+      if (!fds[w].revents)
+        continue;
+      Worker& worker = m_workers[w - 1];
+      std::string message;
+      int res;
+      while ((res = worker.m_connection.read_line(message, false)) == 1)
+        process(worker, message);
+      if (res == -1)
+      {
+        if (worker.m_busy && !worker.m_failures.empty())
+        {
+          // A worker that isn't keeping on exploring stops at its first failure; another worker would stop there too.
+          Dout(dc::warning, "Lost connection with worker " << worker.m_connection.fd() << " after it reported a failure in prefix \"" <<
+              worker.m_prefix << "\"; the rest of that prefix is not explored.");
+          m_unexplored_prefixes.push_back(worker.m_prefix);
+        }
+        else if (worker.m_busy)
+        {
+          Dout(dc::warning, "Lost connection with worker " << worker.m_connection.fd() << " while it was exploring prefix \"" << worker.m_prefix <<
+              "\"; handing it out again.");
+          m_frontier.push_front(worker.m_prefix);
+          ++m_number_of_reassigned_prefixes;
+        }
+        m_failures.insert(m_failures.end(), worker.m_failures.begin(), worker.m_failures.end());
+        m_workers.erase(m_workers.begin() + (w - 1));
+        ++m_changes;
+      }
+    }
+
+    if ((fds[0].revents & POLLIN))
+    {
+      int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd != -1)
+      {
+        m_workers.emplace_back(Connection(fd));
+        ++m_changes;
+      }
+    }
+  }
+
+  for (Worker& worker : m_workers)
+    worker.m_connection.send("QUIT");
+  Dout(dc::notice, "All " << m_number_of_permutations << " permutations finished; " << m_failures.size() << " failed.");
+  for (std::string const& failure : m_failures)
+    TP_REPORT_FAILURE("Permutation \"" << failure.substr(0, failure.find('\t')) << "\" failed assertion " << failure.substr(failure.find('\t') + 1) << ".");
+  for (std::string const& prefix : m_unexplored_prefixes)
+    TP_REPORT_FAILURE("The permutations that start with \"" << prefix << "\" were not completely explored.");
+}
+
+} // namespace thread_permuter
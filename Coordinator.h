@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Connection.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+
+namespace thread_permuter {
+
+// Hands out parts of the search tree to worker processes (see ThreadPermuter::run_worker).
+//
+// The work is described by prefixes: every worker explores all permutations that start with
+// the prefix that it was given. Initially there is only one prefix, the empty one. Whenever
+// a worker is idle while there is no prefix left to hand out, the busy workers are asked
+// to give away the unexplored subtrees that are closest to the root of their part of the tree.
+// A worker that gave away subtrees continues with a longer prefix, and reports the permutations
+// that it played outside of that prefix. When a worker disconnects before it finished, its
+// prefix is handed out again, and what it reported about that prefix is forgotten; unless it
+// reported a failure there (a worker stops at its first failure unless it keeps exploring):
+// then the failures are kept and the prefix is not explored any further.
+//
+// Protocol (one message per line):
+//   worker -> coordinator: READY, DONE <permutations> <redundant>, FAIL <permutation>\t<message>, SPLIT <prefix>,
+//                          STOLEN [<permutations> <redundant> <prefix>].
+//   coordinator -> worker: WORK <prefix>, STEAL, QUIT.
+class Coordinator
+{
+ private:
+  struct Worker
+  {
+    Connection m_connection;
+    bool m_idle;                        // Set when the worker is waiting for a WORK message.
+    bool m_busy;                        // Set while the worker is exploring m_prefix.
+    bool m_steal_sent;                  // Set while a STEAL message wasn't answered yet.
+    int m_steal_refused;                // The value of m_changes when the worker last answered STEAL without giving away work, or -1.
+    std::chrono::steady_clock::time_point m_steal_refused_time; // When that happened.
+    std::string m_prefix;               // The prefix that the worker is exploring.
+    std::vector<std::string> m_failures; // The failures in m_prefix that were reported by the worker, as "permutation\tmessage".
+
+    Worker(Connection&& connection) : m_connection(std::move(connection)), m_idle(false), m_busy(false), m_steal_sent(false), m_steal_refused(-1) { }
+  };
+
+  std::string m_address;                // The address that we listen on.
+  int m_listen_fd;                      // The listening socket.
+  std::vector<Worker> m_workers;        // The connected workers.
+  std::deque<std::string> m_frontier;   // Prefixes that still need to be explored.
+  int m_changes;                        // Incremented when a prefix is added to m_frontier or a worker connects or disconnects.
+  int m_number_of_permutations;         // The total number of permutations reported by the workers.
+  int m_number_of_redundant_permutations;
+  std::vector<std::string> m_failures;  // The failures reported by the workers, as "permutation\tmessage".
+  int m_number_of_reassigned_prefixes;  // The number of prefixes that were handed out again because their worker disconnected.
+  std::vector<std::string> m_unexplored_prefixes; // Prefixes that were given up on, because their worker failed or no workers were left.
+
+ public:
+  // Start listening on address (see Connection).
+  Coordinator(std::string const& address);
+  ~Coordinator();
+
+  // Hand out work until the whole tree was explored, or until all workers disconnected.
+  void run();
+
+  int number_of_permutations() const { return m_number_of_permutations; }
+  int number_of_redundant_permutations() const { return m_number_of_redundant_permutations; }
+  std::vector<std::string> const& failures() const { return m_failures; }
+  int number_of_reassigned_prefixes() const { return m_number_of_reassigned_prefixes; }
+  std::vector<std::string> const& unexplored_prefixes() const { return m_unexplored_prefixes; }
+
+ private:
+  void process(Worker& worker, std::string const& message);
+  // A worker that couldn't give away work is only asked again after something changed, or after this time.
+  static constexpr std::chrono::milliseconds steal_backoff{100};
+};
+
+} // namespace thread_permuter
@@ -0,0 +1,73 @@
+#include "sys.h"
+#include "Coroutine.h"
+#include "debug.h"
+
+namespace thread_permuter {
+
+std::coroutine_handle<> Task::FinalAwaiter::await_suspend(handle_type handle) noexcept
+{
+  std::coroutine_handle<> continuation = handle.promise().m_continuation;
+  // A test function returns to Thread::step.
+  return continuation ? continuation : std::noop_coroutine();
+}
+
+void Task::promise_type::unhandled_exception()
+{
+  if (m_continuation)
+    m_exception = std::current_exception();     // Rethrown by await_resume in the awaiting coroutine.
+  else
+    Thread::coroutine_failed(std::current_exception());
+}
+
+std::coroutine_handle<> Task::await_suspend(std::coroutine_handle<> continuation) noexcept
+{
+  m_handle.promise().m_continuation = continuation;
+  return m_handle;
+}
+
+void Task::await_resume()
+{
+  if (m_handle.promise().m_exception)
+    std::rethrow_exception(m_handle.promise().m_exception);
+}
+
+void Checkpoint::await_suspend(std::coroutine_handle<> handle)
+{
+  Dout(dc::permutation, (m_state == yielding ? "yield" : "block") << " at " << m_location.file_name() << ":" << m_location.line());
+  Thread::checkpoint(CheckpointSite::lookup(m_state == yielding ? "co_await yield()" : "co_await block()", m_location.file_name(), m_location.line()));
+  Thread::suspend(handle, m_state);
+}
+
+bool CoroutineMutex::try_lock()
+{
+  DoutEntering(dc::permutation|continued_cf, "CoroutineMutex::try_lock() [" << (void*)this << "]... ");
+  bool locked = !m_locked;
+  if (locked)
+  {
+    m_locked = true;
+    Thread::acquired(this);
+  }
+  else
+    Thread::touch(this, false);
+  Dout(dc::finish, (locked ? "locked" : "failed"));
+  return locked;
+}
+
+void CoroutineMutex::unlock()
+{
+  DoutEntering(dc::permutation, "CoroutineMutex::unlock() [" << (void*)this << "]");
+  ASSERT(m_locked);
+  Thread::released(this);
+  m_locked = false;
+}
+
+void CoroutineMutex::LockAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+  Dout(dc::permutation, "Blocked on mutex [" << (void*)m_mutex << "]");
+  Thread::blocked_on(m_mutex);
+  Thread::checkpoint(CheckpointSite::lookup("co_await CoroutineMutex::lock()", m_location.file_name(), m_location.line()));
+  // Only resume once the mutex could be locked.
+  Thread::suspend(handle, blocking, [mutex = m_mutex]{ return mutex->try_lock(); });
+}
+
+} // namespace thread_permuter
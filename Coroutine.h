@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Thread.h"
+#include <coroutine>
+#include <exception>
+#include <source_location>
+
+// Test functions that are written as coroutines.
+//
+// Instead of running every test function in its own thread, a test function may
+// be a coroutine returning a thread_permuter::Task. Checkpoints are then written as
+//
+//   co_await tp::yield();      // Instead of TPY.
+//   co_await tp::block();      // Instead of TPB.
+//   co_await mutex.lock();     // Where mutex is a tp::CoroutineMutex.
+//
+// and the permutation engine resumes the coroutine directly, without any thread
+// switches. A Task may also co_await another Task; the steps of the awaited Task
+// then become steps of the test function.
+//
+namespace thread_permuter {
+
+class Task
+{
+ public:
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  // Continue with the coroutine that awaited this Task, if any, when it finished.
+  struct FinalAwaiter
+  {
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(handle_type handle) noexcept;
+    void await_resume() const noexcept { }
+  };
+
+  struct promise_type
+  {
+    std::coroutine_handle<> m_continuation;     // The coroutine that awaits this Task, or null for a test function.
+    std::exception_ptr m_exception;             // The exception that a nested Task exited with.
+
+    Task get_return_object() { return Task(handle_type::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void return_void() { }
+    void unhandled_exception();
+  };
+
+ private:
+  handle_type m_handle;
+
+  explicit Task(handle_type handle) : m_handle(handle) { }
+
+ public:
+  Task(Task&& orig) : m_handle(orig.m_handle) { orig.m_handle = nullptr; }
+  ~Task() { if (m_handle) m_handle.destroy(); }
+
+  // Transfer the ownership of the coroutine to the caller.
+  std::coroutine_handle<> release() { std::coroutine_handle<> handle = m_handle; m_handle = nullptr; return handle; }
+
+  // Awaiting a Task runs it as part of the awaiting coroutine.
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept;
+  void await_resume();
+};
+
+// The awaitable returned by yield() and block().
+class Checkpoint
+{
+ private:
+  state_type m_state;
+  std::source_location m_location;
+
+ public:
+  Checkpoint(state_type state, std::source_location location) : m_state(state), m_location(location) { }
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle);
+  void await_resume() const noexcept { }
+};
+
+// Use this to make the coroutine yield and either continue with a different thread or with the same thread again.
+inline Checkpoint yield(std::source_location location = std::source_location::current())
+{
+  return { yielding, location };
+}
+
+// Use this to make the coroutine yield and force the run of another thread before running this thread again.
+inline Checkpoint block(std::source_location location = std::source_location::current())
+{
+  return { blocking, location };
+}
+
+// Use this instead of Mutex in coroutines.
+//
+// Records itself in the Footprint of the current step like Mutex does.
+class CoroutineMutex
+{
+ private:
+  bool m_locked = false;
+
+ public:
+  class LockAwaiter
+  {
+   private:
+    CoroutineMutex* m_mutex;
+    std::source_location m_location;
+
+   public:
+    LockAwaiter(CoroutineMutex* mutex, std::source_location location) : m_mutex(mutex), m_location(location) { }
+
+    bool await_ready() { return m_mutex->try_lock(); }
+    void await_suspend(std::coroutine_handle<> handle);
+    void await_resume() const noexcept { }
+  };
+
+  // co_await the result to lock the mutex; blocks the test function until it was locked.
+  LockAwaiter lock(std::source_location location = std::source_location::current()) { return { this, location }; }
+  bool try_lock();
+  void unlock();
+};
+
+} // namespace thread_permuter
+
+namespace tp = thread_permuter;
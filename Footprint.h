@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+namespace thread_permuter {
+
+// The shared objects that were accessed by a single step (the code executed between two checkpoints).
+//
+// A Footprint that wasn't annotated at all means "unknown": such a step is assumed to conflict with every other step.
+// Once at least one access was recorded (or the step was marked as local), the recorded accesses are assumed to be complete.
+class Footprint
+{
+ public:
+  struct Access
+  {
+    void const* m_object;       // The address of the shared object that was accessed.
+    bool m_write;               // True if the object was (also) written to.
+  };
+
+ private:
+  std::vector<Access> m_accesses;
+  bool m_known = false;         // Set when the step was annotated.
+
+ public:
+  void clear() { m_accesses.clear(); m_known = false; }
+  bool unknown() const { return !m_known; }
+  std::vector<Access> const& accesses() const { return m_accesses; }
+  void mark_local() { m_known = true; }
+
+  void add(void const* object, bool write)
+  {
+    m_known = true;
+    for (Access& access : m_accesses)
+      if (access.m_object == object)
+      {
+        access.m_write |= write;
+        return;
+      }
+    m_accesses.push_back({object, write});
+  }
+
+  // Returns true if swapping the order of the step with this footprint and the step with footprint other could change the outcome.
+  bool conflicts_with(Footprint const& other) const
+  {
+    if (unknown() || other.unknown())
+      return true;
+    for (Access const& a1 : m_accesses)
+      for (Access const& a2 : other.m_accesses)
+        if (a1.m_object == a2.m_object && (a1.m_write || a2.m_write))
+          return true;
+    return false;
+  }
+};
+
+} // namespace thread_permuter
@@ -0,0 +1,175 @@
+#include "sys.h"
+#include "Minimizer.h"
+#include "Schedule.h"
+#include "debug.h"
+#include <algorithm>
+
+namespace thread_permuter {
+
+namespace {
+
+// A maximal sequence of steps of the same thread.
+struct Run
+{
+  size_t m_start;
+  size_t m_length;
+};
+
+std::vector<Run> runs_of(Minimizer::steps_type const& steps)
+{
+  std::vector<Run> runs;
+  for (size_t si = 0; si < steps.size(); ++si)
+    if (si == 0 || steps[si] != steps[si - 1])
+      runs.push_back({si, 1});
+    else
+      ++runs.back().m_length;
+  return runs;
+}
+
+std::vector<size_t> context_switch_positions(Minimizer::steps_type const& steps)
+{
+  std::vector<size_t> positions;
+  for (size_t si = 1; si < steps.size(); ++si)
+    if (steps[si] != steps[si - 1])
+      positions.push_back(si);
+  return positions;
+}
+
+} // namespace
+
+Minimizer::Minimizer(std::string const& failing_permutation) : m_best(steps_of(failing_permutation)), m_next_candidate(0)
+{
+  m_tried.insert(failing_permutation);
+  generate_candidates();
+}
+
+//static
+Minimizer::steps_type Minimizer::steps_of(std::string const& permutation)
+{
+  steps_type steps;
+  size_t pos = 0;
+  while (pos < permutation.size())
+    steps.push_back(extract_thi(permutation, pos));
+  return steps;
+}
+
+//static
+std::string Minimizer::str(steps_type const& steps)
+{
+  std::string permutation;
+  for (ThreadIndex thi : steps)
+    append_thi(permutation, thi);
+  return permutation;
+}
+
+//static
+int Minimizer::context_switches(std::string const& permutation)
+{
+  return context_switch_positions(steps_of(permutation)).size();
+}
+
+//static
+bool Minimizer::simpler(std::string const& permutation1, std::string const& permutation2)
+{
+  return simpler(steps_of(permutation1), steps_of(permutation2));
+}
+
+//static
+bool Minimizer::simpler(steps_type const& steps1, steps_type const& steps2)
+{
+  std::vector<size_t> const positions1 = context_switch_positions(steps1);
+  std::vector<size_t> const positions2 = context_switch_positions(steps2);
+  if (positions1.size() != positions2.size())
+    return positions1.size() < positions2.size();
+  if (steps1.size() != steps2.size())
+    return steps1.size() < steps2.size();
+  // The first context switch that is different should be later.
+  return positions1 > positions2;
+}
+
+void Minimizer::generate_candidates()
+{
+  m_candidates.clear();
+  m_next_candidate = 0;
+  std::vector<Run> const runs = runs_of(m_best);
+  auto append_runs = [&](steps_type& candidate, size_t begin, size_t end){     // Append the runs [begin, end).
+    if (begin < end)
+      candidate.insert(candidate.end(), m_best.begin() + runs[begin].m_start, m_best.begin() + runs[end - 1].m_start + runs[end - 1].m_length);
+  };
+
+  // Merge two runs of the same thread.
+  for (size_t i = 0; i < runs.size(); ++i)
+  {
+    size_t j = i + 1;
+    while (j < runs.size() && m_best[runs[j].m_start] != m_best[runs[i].m_start])
+      ++j;
+    if (j == runs.size())
+      continue;
+    // Move run j up to run i.
+    steps_type candidate;
+    append_runs(candidate, 0, i + 1);
+    append_runs(candidate, j, j + 1);
+    append_runs(candidate, i + 1, j);
+    append_runs(candidate, j + 1, runs.size());
+    m_candidates.push_back(std::move(candidate));
+    // Move run i down to run j.
+    candidate.clear();
+    append_runs(candidate, 0, i);
+    append_runs(candidate, i + 1, j);
+    append_runs(candidate, i, i + 1);
+    append_runs(candidate, j, runs.size());
+    m_candidates.push_back(std::move(candidate));
+  }
+
+  // Move a context switch one step later.
+  for (size_t si : context_switch_positions(m_best))
+  {
+    auto const next = std::find(m_best.begin() + si, m_best.end(), m_best[si - 1]);
+    if (next == m_best.end())
+      continue;
+    steps_type candidate = m_best;
+    candidate.erase(candidate.begin() + (next - m_best.begin()));
+    candidate.insert(candidate.begin() + si, m_best[si - 1]);
+    m_candidates.push_back(std::move(candidate));
+  }
+}
+
+bool Minimizer::next_candidate()
+{
+  while (m_next_candidate < m_candidates.size())
+  {
+    steps_type const& candidate = m_candidates[m_next_candidate++];
+    if (!m_tried.insert(str(candidate)).second)
+      continue;
+    m_candidate = candidate;
+    return true;
+  }
+  return false;
+}
+
+ThreadIndex Minimizer::choose(threads_set_type runnable_threads, int si)
+{
+  // Follow the candidate for as long as possible; otherwise avoid a context switch.
+  if (si < static_cast<int>(m_candidate.size()))
+  {
+    ThreadIndex const thi = m_candidate[si];
+    if ((runnable_threads & index2mask(thi)).any())
+      return m_last_thi = thi;
+  }
+  if (si > 0 && (runnable_threads & index2mask(m_last_thi)).any())
+    return m_last_thi;
+  return m_last_thi = runnable_threads.lssbi();
+}
+
+void Minimizer::result(std::string const& played, bool same_failure)
+{
+  Dout(dc::permutation, "Minimizer::result(\"" << played << "\", " << std::boolalpha << same_failure << ")");
+  steps_type played_steps = steps_of(played);
+  if (!same_failure || !simpler(played_steps, m_best))
+    return;
+  m_best = std::move(played_steps);
+  m_tried.insert(played);
+  generate_candidates();
+}
+
+} // namespace thread_permuter
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Thread.h"
+#include <string>
+#include <vector>
+#include <set>
+
+namespace thread_permuter {
+
+// Shrinks a failing permutation to a simpler one that fails the same way.
+//
+// Starting from the permutation of the failure (up to and including the step that failed),
+// candidates are generated that
+//   - merge two runs of the same thread (removing at least one context switch), by moving
+//     the later run up to the earlier one or the earlier run down to the later one;
+//   - move a context switch one step later, by letting the thread that ran before the switch
+//     do one more step first.
+// A candidate is played by letting choose() follow it for as long as the thread that it wants
+// can run. Whatever was actually played is passed to result(); when it failed at the same site
+// and is simpler (fewer context switches, then fewer steps, then later context switches) it
+// becomes the new best permutation and new candidates are generated from that.
+//
+// Permutations are converted to a vector with one thread index per step when they are passed in,
+// and back when they are passed out; the threads beyond 'Z' take more than one character.
+class Minimizer
+{
+ public:
+  using steps_type = std::vector<ThreadIndex>;
+
+ private:
+  steps_type m_best;                    // The simplest failing permutation so far.
+  std::vector<steps_type> m_candidates; // The candidates derived from m_best, most promising first.
+  size_t m_next_candidate;              // The index into m_candidates of the next candidate to try.
+  std::set<std::string> m_tried;        // All candidates that were tried, as permutation strings.
+  steps_type m_candidate;               // The candidate that is being played.
+  ThreadIndex m_last_thi;               // The thread that was chosen for the previous step.
+
+ public:
+  Minimizer(std::string const& failing_permutation);
+
+  // Prepare the next candidate to be played. Returns false when there are no candidates left.
+  bool next_candidate();
+
+  // Return the thread that must do step si of the current candidate, one of the threads in runnable_threads.
+  ThreadIndex choose(threads_set_type runnable_threads, int si);
+
+  // Pass what was played for the current candidate (up to and including the failing step, if it failed)
+  // and whether or not it failed at the same site as the original permutation.
+  void result(std::string const& played, bool same_failure);
+
+  // The simplest failing permutation found.
+  std::string best() const { return str(m_best); }
+
+  // Return the number of context switches of permutation.
+  static int context_switches(std::string const& permutation);
+  // Return true if permutation1 is simpler than permutation2.
+  static bool simpler(std::string const& permutation1, std::string const& permutation2);
+
+  // Convert a permutation string to its steps and back.
+  static steps_type steps_of(std::string const& permutation);
+  static std::string str(steps_type const& steps);
+
+ private:
+  static bool simpler(steps_type const& steps1, steps_type const& steps2);
+  void generate_candidates();
+};
+
+} // namespace thread_permuter
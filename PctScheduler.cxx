@@ -0,0 +1,45 @@
+#include "sys.h"
+#include "PctScheduler.h"
+#include "debug.h"
+#include <algorithm>
+#include <numeric>
+
+namespace thread_permuter {
+
+PctScheduler::PctScheduler(uint64_t seed, int number_of_threads, int depth, int number_of_steps) :
+  m_random_number_generator(seed), m_priorities(number_of_threads)
+{
+  // The initial priorities are depth, depth + 1, ..., in a random order.
+  std::iota(m_priorities.begin(), m_priorities.end(), depth);
+  std::shuffle(m_priorities.begin(), m_priorities.end(), m_random_number_generator);
+  std::uniform_int_distribution<int> step_distribution(0, std::max(number_of_steps - 1, 0));
+  for (int i = 1; i < depth; ++i)
+    m_change_points.push_back(step_distribution(m_random_number_generator));
+}
+
+ThreadIndex PctScheduler::choose(threads_set_type runnable_threads, int si)
+{
+  auto highest_priority = [&]{
+    ThreadIndex best;
+    int best_priority = -1;
+    for (ThreadIndex thi(0); thi < ThreadIndex(m_priorities.size()); ++thi)
+      if ((runnable_threads & index2mask(thi)).any() && m_priorities[thi.get_value()] > best_priority)
+      {
+        best = thi;
+        best_priority = m_priorities[thi.get_value()];
+      }
+    return best;
+  };
+  ThreadIndex thi = highest_priority();
+  // The i-th change point lowers the priority of the thread that would run to i (i < depth).
+  for (size_t i = 0; i < m_change_points.size(); ++i)
+    if (m_change_points[i] == si)
+    {
+      Dout(dc::permutation, "PCT change point " << (i + 1) << " at step " << si << ": lowering the priority of thread " << thi << ".");
+      m_priorities[thi.get_value()] = i + 1;
+      thi = highest_priority();
+    }
+  return thi;
+}
+
+} // namespace thread_permuter
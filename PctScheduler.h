@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Thread.h"
+#include <random>
+#include <vector>
+#include <cstdint>
+
+namespace thread_permuter {
+
+// Chooses the thread that runs next according to the PCT algorithm (probabilistic concurrency testing).
+//
+// Every thread gets a random, distinct initial priority of at least depth, and there are depth - 1
+// randomly chosen steps (change points) at which the priority of the thread that would run is
+// lowered to below all initial priorities. At every step the running thread with the highest
+// priority is chosen. A bug that requires a specific ordering of depth steps is found with a
+// probability of at least 1 / (n * k^(depth - 1)) per run, where n is the number of threads and
+// k the number of steps.
+class PctScheduler
+{
+ private:
+  std::mt19937_64 m_random_number_generator;
+  std::vector<int> m_priorities;        // The current priority of each thread.
+  std::vector<int> m_change_points;     // The steps at which the priority of the chosen thread is lowered.
+
+ public:
+  // number_of_steps is an estimate of the number of steps of a single run.
+  PctScheduler(uint64_t seed, int number_of_threads, int depth, int number_of_steps);
+
+  // Return the thread that must do step si, one of the threads in runnable_threads.
+  ThreadIndex choose(threads_set_type runnable_threads, int si);
+};
+
+} // namespace thread_permuter
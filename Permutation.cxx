@@ -3,12 +3,16 @@
 #include "ConditionVariable.h"
 #include "utils/log2.h"
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
 
 namespace thread_permuter {
 
 // Step thread thi and update m_blocked_threads and m_running_threads accordingly.
 // Returns true if after this step the thread is still running (not blocked and not finished).
-bool Permutation::step(thi_type thi, std::string& permutation_string)
+bool Permutation::step(thi_type thi, Schedule& schedule)
 {
   DoutEntering(dc::permutation, "Permutation::step(" << thi << ")");
   threads_set_type thm = index2mask(thi);
@@ -16,9 +20,30 @@ bool Permutation::step(thi_type thi, std::string& permutation_string)
   // The most likely reason for asserting here is when you pass an illegal permutation to ThreadPermuter::run();
   // for example, when you changed the program and are still using an old permutation string.
   ASSERT((thm & ~m_blocked_threads & m_running_threads).any());
-  permutation_string += '0' + thi.get_value();
+  schedule.push_back(thi);
+  ++m_current_step;
+  m_started_threads |= thm;
   Thread& thread(m_threads[thi]);
-  switch (thread.step(m_debug_on))
+  threads_set_type const enabled_threads = m_running_threads & ~m_blocked_threads;
+  if (m_current_step > 1 && thi != m_last_thi && (enabled_threads & index2mask(m_last_thi)).any())
+    ++m_preemptions;
+  // The choice of the thread that runs this step is made at the checkpoint where the previous step ended.
+  // The step that differs from the previous play() is where the current permutation branched off.
+  CheckpointSite const& site = m_current_step > 1 ? m_threads[m_last_thi].checkpoint_site() : thread.checkpoint_site();
+  site.count_step(!enabled_threads.is_single_bit(), m_current_step - 1 == m_first_new_step);
+  m_last_thi = thi;
+  state_type const state = thread.step(m_debug_on);
+  if (m_dpor || m_sleep_sets)
+  {
+    m_trace.push_back({thi, enabled_threads, thread.footprint()});
+    // Steps that block other threads can never be swapped with anything.
+    if (state == notify_one || state == woken || state == failed)
+      m_trace.back().m_footprint.clear();
+    size_t const si = m_trace.size() - 1;
+    if (m_sleep_sets && si < m_footprints.size())
+      m_footprints[si][thi] = m_trace.back().m_footprint;
+  }
+  switch (state)
   {
     case yielding:
       m_blocked_threads.reset();
@@ -93,34 +118,66 @@ bool Permutation::step(thi_type thi, std::string& permutation_string)
 }
 
 // Play back the recording.
-void Permutation::play(std::string& permutation_string, bool run_complete)
+void Permutation::play(Schedule& schedule, bool run_complete)
 {
   DoutEntering(dc::permutation, "Permutation::play(" << std::boolalpha << run_complete << ")");
   using namespace utils::bitset;
 
   thi_type const thread_end(m_threads.size());
-  m_running_threads = index2mask(thread_end) - 1;       // Set all threads to running.
+  m_running_threads = indices_below(thread_end);        // Set all threads to running.
   m_blocked_threads.reset();                            // Nothing is blocked.
   m_waiting_threads.reset();                            // Nothing is waiting.
   m_woken_threads.reset();                              // Nothing was woken up temporarily.
-  bool first_run = m_blocked.empty();
-  for (auto thi : m_steps)
+  m_started_threads.reset();                            // Nothing was run yet.
+  m_trace.clear();
+  m_redundant = false;
+  m_dead_locked = false;
+  m_current_step = 0;
+  m_preemptions = 0;
+  if (!m_program.empty())
   {
-    if (first_run)
+    // Record the programmed steps. They are only forgotten once all of them were played.
+    clear_steps();
+    for (int si = 0; si < m_program.size(); ++si)
     {
-      m_blocked.push_back(m_blocked_threads);
-      m_waiting.push_back(m_waiting_threads);
-      m_woken.push_back(m_woken_threads);
+      thi_type const thi = m_program[si];
+      // Programmed steps are never put to sleep.
+      threads_set_type sleep;
+      sleep.reset();
+      push_step(thi, sleep);
+      step(thi, schedule);
     }
-    step(thi, permutation_string);
+    m_program.clear();
+  }
+  replay(schedule, run_complete);
+}
+
+// Play the steps of m_steps from m_current_step on.
+void Permutation::replay(Schedule& schedule, bool run_complete)
+{
+  while (m_current_step < static_cast<int>(m_steps.size()))
+  {
+    if (snapshot(m_current_step))
+      continue;         // Continue from a snapshot, with a new m_steps.
+    step(m_steps[m_current_step].m_thi, schedule);
+    if (m_state_hash)
+      prune_visited_state();
   }
   // Complete the permutation by running all remaining threads till they are finished too, if so requested.
   if (run_complete && m_running_threads.any())
-    complete(permutation_string);
+    complete(schedule);
+}
+
+bool Permutation::snapshot(int si)
+{
+  // Only take snapshots at new branch points.
+  if (!m_snapshot_hook || si < m_first_new_step || (m_running_threads & ~m_blocked_threads).count() < 2)
+    return false;
+  return m_snapshot_hook(si);
 }
 
 // Run an incomplete permutation to completion.
-void Permutation::complete(std::string& permuation_string)
+void Permutation::complete(Schedule& schedule)
 {
   DoutEntering(dc::permutation, "Permutation::complete()");
   using namespace utils::bitset;
@@ -132,37 +189,199 @@ void Permutation::complete(std::string& permuation_string)
   {
     threads_set_type yielding_threads = m_running_threads & ~m_blocked_threads;
     if (yielding_threads.none())
-      DoutFatal(dc::core, "Dead locked (all still running threads are blocked)! While running: " << permuation_string);
-    Index thi = yielding_threads.lssbi();
-    m_steps.push_back(thi);
-    m_blocked.push_back(m_blocked_threads);
-    m_waiting.push_back(m_waiting_threads);
-    m_woken.push_back(m_woken_threads);
-    step(thi, permuation_string);
+      dead_lock(schedule);
+    int const si = m_steps.size();
+    if (snapshot(si))
+    {
+      // This process continues from a snapshot; play the new steps.
+      replay(schedule, true);
+      return;
+    }
+    yielding_threads &= ~symmetric_threads();
+    threads_set_type sleep;
+    sleep.reset();
+    if (m_sleep_sets)
+      sleep = sleep_set(si);
+    threads_set_type awake_threads = yielding_threads & ~sleep;
+    if (awake_threads.none())
+    {
+      // Everything that can happen from here on was already covered by another permutation;
+      // just finish the running threads and don't vary any of the following steps.
+      Dout(dc::permutation, "All threads that can run are asleep at step " << si << ".");
+      awake_threads = yielding_threads;
+      m_prune_depth = std::min(m_prune_depth, si);
+      m_redundant = true;
+    }
+    thi_type thi;
+    if (m_chooser)
+      thi = m_chooser(awake_threads, si);
+    else if (m_preemption_bound >= 0 && si > 0 && (awake_threads & index2mask(m_steps[si - 1].m_thi)).any())
+      thi = m_steps[si - 1].m_thi;      // Avoid a preemption.
+    else
+      thi = awake_threads.lssbi();
+    push_step(thi, sleep);
+    step(thi, schedule);
+    if (m_state_hash)
+      prune_visited_state();
   }
   // Now there is only one running thread left.
-  Index const last_thi = m_running_threads.lssbi();
+  thi_type const last_thi = m_running_threads.lssbi();
   // Finished threads aren't blocked, are they?
   ASSERT((m_blocked_threads & ~m_running_threads).none());
   // Actually run that one to completion too, but don't add it to m_steps.
   do
   {
     if (m_running_threads == m_blocked_threads)
-      DoutFatal(dc::core, "Dead locked (last running thread is blocked)! While running: " << permuation_string);
-    step(last_thi, permuation_string);
+      dead_lock(schedule);
+    step(last_thi, schedule);
   }
   while (!m_running_threads.none());
   // We shouldn't have reset m_running_threads though.
-  m_running_threads = last_thi;
+  m_running_threads = index2mask(last_thi);
 
   int static count;
   if (++count % 1000 == 0 || count < 100)
-    std::cout << "Completed: " << permuation_string << std::endl;
+    std::cout << "Completed: " << schedule << std::endl;
+}
+
+std::string Permutation::describe_dead_lock() const
+{
+  thi_type const thread_end(m_threads.size());
+  // The thread that each thread waits for (the owner of the Mutex that it is blocked on), if known.
+  utils::Vector<int, thi_type> waits_for(m_threads.size(), -1);
+  std::ostringstream description;
+  description << "dead lock:";
+  char const* separator = " ";
+  for (thi_type thi(0); thi < thread_end; ++thi)
+  {
+    if ((m_running_threads & index2mask(thi)).none())
+      continue;
+    Thread const& thread(m_threads[thi]);
+    description << separator << "thread " << thi.get_value();
+    separator = "; ";
+    if (void const* mutex = thread.waits_for())
+    {
+      description << " waits for mutex " << mutex;
+      thi_type owner(0);
+      for (; owner < thread_end; ++owner)
+      {
+        auto const& held_mutexes = m_threads[owner].held_mutexes();
+        if (std::find(held_mutexes.begin(), held_mutexes.end(), mutex) != held_mutexes.end())
+          break;
+      }
+      if (owner == thread_end)
+        description << " held by no test function";
+      else
+      {
+        description << " held by thread " << owner.get_value();
+        if ((m_running_threads & index2mask(owner)).none())
+          description << " (finished)";
+        else
+          waits_for[thi] = owner.get_value();
+      }
+    }
+    else if (thread.state() == waiting)
+      description << " waits on condition variable " << static_cast<void const*>(thread.condition_variable());
+    else if (thread.state() == notify_one)
+    {
+      // After notify_one, a thread that was woken must run first.
+      ConditionVariable const* cv = thread.condition_variable();
+      description << " notified condition variable " << static_cast<void const*>(cv);
+      threads_set_type const woken_threads = cv->waiting_threads();
+      if (woken_threads.is_single_bit())
+        for (thi_type woken(0); woken < thread_end; ++woken)
+          if ((woken_threads & index2mask(woken)).any())
+          {
+            description << " and waits for thread " << woken.get_value();
+            waits_for[thi] = woken.get_value();
+          }
+    }
+    else
+      description << " is blocked (TPB)";
+  }
+  // Every thread waits for at most one other thread; follow those from every thread to find a cycle.
+  for (thi_type start(0); start < thread_end; ++start)
+  {
+    std::vector<int> path;
+    int thread = start.get_value();
+    while (thread != -1 && std::find(path.begin(), path.end(), thread) == path.end())
+    {
+      path.push_back(thread);
+      thread = waits_for[thi_type(thread)];
+    }
+    if (thread == -1)
+      continue;
+    // The cycle starts where the path ran into itself.
+    description << "; wait-for cycle";
+    auto const cycle_begin = std::find(path.begin(), path.end(), thread);
+    for (auto iter = cycle_begin; iter != path.end(); ++iter)
+      description << ' ' << *iter << " ->";
+    description << ' ' << thread;
+    break;
+  }
+  return description.str();
+}
+
+void Permutation::dead_lock(Schedule const& schedule)
+{
+  std::string const description = describe_dead_lock();
+#ifdef CWDEBUG
+  // Like TP_ASSERT: when debug output is on (the failing permutation is being run again) stop here.
+  LIBCWD_TSD_DECLARATION;
+  if (LIBCWD_DO_TSD_MEMBER_OFF(libcwd::libcw_do))
+    DoutFatal(dc::core, "Dead locked (" << description << ")! While running: " << schedule);
+#endif
+  Dout(dc::permutation, "Dead locked (" << description << "). Abandoning the running threads.");
+  thi_type const thread_end(m_threads.size());
+  for (thi_type thi(0); thi < thread_end; ++thi)
+    if ((m_running_threads & index2mask(thi)).any())
+      m_threads[thi].abandon();
+  // m_running_threads is left alone: next() needs to know which threads were still running at the end.
+  m_dead_locked = true;
+  throw PermutationFailure(description.c_str(), "<dead lock>", 0);
+}
+
+void Permutation::finish(Schedule& schedule)
+{
+  DoutEntering(dc::permutation, "Permutation::finish()");
+  // A failure during replay() leaves the steps that weren't played yet behind; forget those.
+  size_t const played_steps = m_current_step;
+  if (played_steps < m_steps.size())
+  {
+    m_steps.resize(played_steps);
+    m_done.resize(played_steps);
+    m_backtrack.resize(played_steps);
+    m_sleep.resize(played_steps);
+    if (m_footprints.size() > played_steps)
+      m_footprints.resize(played_steps);
+  }
+  // Every permutation that starts with the steps up to the failure fails the same way; don't vary the steps after it.
+  m_prune_depth = std::min(m_prune_depth, m_current_step);
+  // Failures of the other threads are ignored. Threads that were abandoned because of a dead lock are already finished.
+  while (m_running_threads.any() && !m_dead_locked)
+  {
+    try
+    {
+      complete(schedule);
+      return;
+    }
+    catch (PermutationFailure const& error)
+    {
+      Dout(dc::permutation, "Ignoring failure " << error.message() << " while finishing the threads.");
+    }
+  }
 }
 
 bool Permutation::next(int limit)
 {
   DoutEntering(dc::permutation, "Permutation::next(" << limit << ")");
+  // Do not vary steps that were pruned during the last play().
+  limit = std::min(limit, m_prune_depth);
+  m_prune_depth = std::numeric_limits<int>::max();
+  if (m_dpor)
+    return next_dpor(limit);
+  if (m_preemption_bound >= 0)
+    return next_bounded(limit);
   Dout(dc::permutation, "Permutation before: " << *this);
   // Advance the permutation to the next.
   //
@@ -197,37 +416,41 @@ bool Permutation::next(int limit)
   // Let si be the index into m_steps and start
   // scanning from the right-most position.
   int si = m_steps.size();
-  ASSERT(m_blocked.size() == si);
-  ASSERT(m_waiting.size() == si && m_woken.size() == si);
   while (--si >= limit)
-    m_running_threads |= index2mask(m_steps[si]);
-  while (si >= 0)
+    m_running_threads |= index2mask(m_steps[si].m_thi);
+  while (si >= m_floor)
   {
-    thi_type thi = m_steps[si];                                                         // As per the above example, assume thi == 2 now.
+    thi_type thi = m_steps[si].m_thi;                                                   // As per the above example, assume thi == 2 now.
     threads_set_type thm = index2mask(thi);                                             //               thm = 00000100
-    threads_set_type blocked_threads = m_blocked[si];
+    threads_set_type blocked_threads = m_steps[si].m_blocked;
     // When scanning further to the left, this thread is now also running.
     m_running_threads |= thm;                                                           // m_running_threads = 00110111
     // Get a copy of m_running_threads without thi.
     threads_set_type hi_rts = m_running_threads ^ thm;                                  //            hi_rts = 00110011
     // Do not consider currently blocked threads.                                                                ^^
     hi_rts &= ~blocked_threads;                                                         //                       ||
+    // Nor threads that are asleep, or that must wait for an identical thread.                                  ||
+    hi_rts &= ~(m_sleep[si] | m_steps[si].m_symmetric);                                 //                       ||
     if (hi_rts > thm)   // Is there a running thread with an index larger than m_steps[si]?     // Yes, because  \\__ we have bits here.
     {
       // We found the step that needs to be incremented (si).
       // Also remove the thi's that are lower than thi.
-      hi_rts &= ~(thm - 1);                                                             //            hi_rts = 00110000
+      hi_rts &= ~indices_below(thi);                                                    //            hi_rts = 00110000
       // Then increment m_steps[si] to the set index above thi,                                                   ^
       // the index of the least significant set bit in hi_rts.                                                    |
-      m_steps[si] = hi_rts.lssbi();                                                     // m_steps[si] = 4 -------'
-      m_steps.resize(si + 1);                                                           // Resize m_steps to just "3 4 4".
-      m_blocked.resize(si + 1);         // Note that m_blocked is still correct because it refers to what happened *before* this step.
-      m_waiting.resize(si + 1);         // Idem.
-      m_woken.resize(si + 1);           // Idem.
+      m_steps[si].m_thi = hi_rts.lssbi();                                               // m_steps[si] = 4 -------'
+      m_done[si] |= index2mask(m_steps[si].m_thi);
+      m_first_new_step = si;
+      m_steps.resize(si + 1);           // Resize m_steps to just "3 4 4". Note that m_blocked etc. of the last
+                                        // record are still correct because they refer to what happened *before* this step.
+      m_done.resize(si + 1);
+      m_backtrack.resize(si + 1);
+      m_sleep.resize(si + 1);
+      m_footprints.resize(si + 1);
       // Restore those values.
-      m_blocked_threads = m_blocked[si];
-      m_waiting_threads = m_waiting[si];
-      m_woken_threads = m_woken[si];
+      m_blocked_threads = m_steps[si].m_blocked;
+      m_waiting_threads = m_steps[si].m_waiting;
+      m_woken_threads = m_steps[si].m_woken;
       Dout(dc::permutation, "Permutation after: " << *this);
       return true;
     }
@@ -236,28 +459,421 @@ bool Permutation::next(int limit)
   return false;
 }
 
-void Permutation::program(std::string const& steps)
+// Classic DPOR (Flanagan and Godefroid), using the Footprint of each step as recorded in m_trace.
+//
+// For every step j of the last play() we look, for each other thread, for the last earlier
+// step i of that thread that conflicts with j. Reversing the order of i and j might lead to a
+// different result, so the thread of j is added to m_backtrack[i] (or, if that thread couldn't
+// run at i, every thread that could). Alternatives are only tried for steps that were added this way.
+void Permutation::update_backtrack_sets(int limit)
+{
+  int const number_of_steps = m_steps.size();
+  for (int j = 1; j < (int)m_trace.size(); ++j)
+  {
+    TraceStep const& step_j = m_trace[j];
+    threads_set_type const thm_j = index2mask(step_j.m_thi);
+    threads_set_type seen = thm_j;                      // Threads whose last conflicting step was already found.
+    for (int i = j - 1; i >= 0; --i)
+    {
+      TraceStep const& step_i = m_trace[i];
+      threads_set_type const thm_i = index2mask(step_i.m_thi);
+      if ((seen & thm_i).any() || !step_i.m_footprint.conflicts_with(step_j.m_footprint))
+        continue;
+      seen |= thm_i;
+      if (i >= number_of_steps || i >= limit)
+        continue;
+      if ((step_i.m_enabled & thm_j).any())
+        m_backtrack[i] |= thm_j;
+      else
+        m_backtrack[i] |= step_i.m_enabled;
+    }
+  }
+}
+
+bool Permutation::next_dpor(int limit)
+{
+  update_backtrack_sets(limit);
+  Dout(dc::permutation, "Permutation before: " << *this);
+  int si = m_steps.size();
+  ASSERT(m_done.size() == si && m_backtrack.size() == si);
+  while (--si >= m_floor)
+  {
+    if (si >= limit)
+      continue;
+    threads_set_type todo = m_backtrack[si] & ~m_done[si] & ~m_sleep[si] & ~m_steps[si].m_symmetric;
+    if (todo.any())
+    {
+      backtrack_to(si, todo.lssbi());
+      return true;
+    }
+  }
+  return false;
+}
+
+// Replace step si with thi and forget about all steps after it.
+void Permutation::backtrack_to(int si, thi_type thi)
+{
+  m_done[si] |= index2mask(thi);
+  m_steps[si].m_thi = thi;
+  m_first_new_step = si;
+  m_steps.resize(si + 1);
+  m_done.resize(si + 1);
+  m_backtrack.resize(si + 1);
+  m_sleep.resize(si + 1);
+  m_footprints.resize(si + 1);
+  m_blocked_threads = m_steps[si].m_blocked;
+  m_waiting_threads = m_steps[si].m_waiting;
+  m_woken_threads = m_steps[si].m_woken;
+  Dout(dc::permutation, "Permutation after: " << *this);
+}
+
+// The implementation of next() when m_preemption_bound is set.
+//
+// Every thread that wasn't tried yet at a step is tried, unless that would make the number of preemptions
+// exceed m_preemption_bound. A preemption is a step of another thread than the one that did the previous step,
+// while that thread could have continued. complete() continues with the same thread whenever possible,
+// so that the steps that it adds never add a preemption.
+bool Permutation::next_bounded(int limit)
+{
+  Dout(dc::permutation, "Permutation before: " << *this);
+  int const number_of_steps = m_steps.size();
+  // Reconstruct which threads were running at each step, just like next() does.
+  std::vector<threads_set_type> running_threads(number_of_steps);
+  threads_set_type running = m_running_threads;
+  for (int si = number_of_steps - 1; si >= 0; --si)
+  {
+    running |= index2mask(m_steps[si].m_thi);
+    running_threads[si] = running;
+  }
+  // Count the preemptions before each step.
+  auto is_preemption = [&](int si, thi_type thi){
+    return si > 0 && thi != m_steps[si - 1].m_thi && (running_threads[si] & ~m_steps[si].m_blocked & index2mask(m_steps[si - 1].m_thi)).any();
+  };
+  std::vector<int> preemptions(number_of_steps + 1, 0);
+  for (int si = 0; si < number_of_steps; ++si)
+    preemptions[si + 1] = preemptions[si] + (is_preemption(si, m_steps[si].m_thi) ? 1 : 0);
+  for (int si = std::min(number_of_steps, limit) - 1; si >= m_floor; --si)
+  {
+    threads_set_type todo = running_threads[si] & ~m_steps[si].m_blocked & ~m_steps[si].m_symmetric & ~m_done[si];
+    while (todo.any())
+    {
+      thi_type thi = todo.lssbi();
+      todo &= ~index2mask(thi);
+      if (preemptions[si] + (is_preemption(si, thi) ? 1 : 0) > m_preemption_bound)
+      {
+        m_bound_exceeded = true;        // Try this again with a larger bound.
+        continue;
+      }
+      backtrack_to(si, thi);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Give away the alternatives of the first step (at or beyond the floor) that still has any.
+//
+// The prefixes of the permutations that must still be explored are appended to prefixes,
+// and the floor is raised so that next() will no longer generate them.
+// This may only be called after play() and only in the exhaustive search (not with DPOR).
+bool Permutation::split(int limit, std::vector<std::string>& prefixes)
+{
+  ASSERT(!m_dpor);
+  limit = std::min({limit, m_prune_depth, (int)m_steps.size()});
+  // Reconstruct which threads were running at each step, just like next() does.
+  std::vector<threads_set_type> running_threads(m_steps.size());
+  threads_set_type running = m_running_threads;
+  for (int si = m_steps.size() - 1; si >= m_floor; --si)
+  {
+    running |= index2mask(m_steps[si].m_thi);
+    running_threads[si] = running;
+  }
+  for (int si = m_floor; si < limit; ++si)
+  {
+    threads_set_type const thm = index2mask(m_steps[si].m_thi);
+    // The same alternatives as next() would generate: running threads with a larger index that aren't blocked or asleep.
+    threads_set_type alternatives = running_threads[si] & ~m_steps[si].m_blocked & ~m_sleep[si] & ~m_steps[si].m_symmetric &
+        ~indices_below(m_steps[si].m_thi) & ~thm;
+    if (alternatives.none())
+      continue;
+    std::string prefix;
+    for (int pi = 0; pi < si; ++pi)
+      append_thi(prefix, m_steps[pi].m_thi);
+    thi_type const thread_end(m_threads.size());
+    for (thi_type thi(0); thi < thread_end; ++thi)
+      if ((alternatives & index2mask(thi)).any())
+      {
+        prefixes.push_back(prefix);
+        append_thi(prefixes.back(), thi);
+      }
+    m_floor = si + 1;
+    return true;
+  }
+  return false;
+}
+
+std::string Permutation::floor_prefix() const
+{
+  std::string prefix;
+  for (int si = 0; si < m_floor; ++si)
+    append_thi(prefix, m_steps[si].m_thi);
+  return prefix;
+}
+
+// Sleep sets (Godefroid).
+//
+// A thread is asleep at step si when its next step was already tried at an earlier
+// step (or it was asleep there) and everything that was run since is independent of it.
+// Running it now would only lead to permutations that are equivalent to ones that were
+// already covered.
+threads_set_type Permutation::sleep_set(int si) const
+{
+  threads_set_type sleep;
+  sleep.reset();
+  if (si == 0)
+    return sleep;
+  int const prev = si - 1;
+  thi_type const prev_thi = m_steps[prev].m_thi;
+  footprints_type const& footprints = m_footprints[prev];
+  Footprint const& prev_footprint = footprints[prev_thi];
+  threads_set_type const candidates = (m_sleep[prev] | m_done[prev]) & ~index2mask(prev_thi);
+  thi_type const thread_end(m_threads.size());
+  for (thi_type thi(0); thi < thread_end; ++thi)
+    if ((candidates & index2mask(thi)).any() && !footprints[thi].conflicts_with(prev_footprint))
+      sleep |= index2mask(thi);
+  return sleep;
+}
+
+void Permutation::set_symmetry_classes(std::vector<int> const& classes)
+{
+  // There must be one class for every thread.
+  ASSERT(classes.size() == m_threads.size());
+  thi_type const thread_end(m_threads.size());
+  m_lower_symmetric = utils::Vector<threads_set_type, thi_type>(m_threads.size());
+  for (thi_type thi(0); thi < thread_end; ++thi)
+  {
+    m_lower_symmetric[thi].reset();
+    for (thi_type lower(0); lower < thi; ++lower)
+      if (classes[lower.get_value()] == classes[thi.get_value()])
+        m_lower_symmetric[thi] |= index2mask(lower);
+  }
+}
+
+// Symmetry reduction.
+//
+// Threads of the same class run the same test function and are indistinguishable until they did their first step.
+// Every permutation in which a thread starts before a thread of the same class with a lower index is a relabeling
+// of one in which the thread with the lower index starts first; only the latter is explored.
+threads_set_type Permutation::symmetric_threads() const
+{
+  threads_set_type symmetric;
+  symmetric.reset();
+  if (m_lower_symmetric.empty())
+    return symmetric;
+  thi_type const thread_end(m_threads.size());
+  threads_set_type const not_started = indices_below(thread_end) & ~m_started_threads;
+  for (thi_type thi(0); thi < thread_end; ++thi)
+    if ((not_started & index2mask(thi)).any() && (not_started & m_lower_symmetric[thi]).any())
+      symmetric |= index2mask(thi);
+  return symmetric;
+}
+
+void Permutation::push_step(thi_type thi, threads_set_type sleep)
+{
+  int const si = m_steps.size();
+  m_steps.push_back({thi, m_blocked_threads, m_waiting_threads, m_woken_threads, symmetric_threads()});
+  m_done.push_back(index2mask(thi));
+  m_backtrack.push_back(index2mask(thi));
+  m_sleep.push_back(sleep);
+  if (m_sleep_sets)
+  {
+    m_footprints.emplace_back(m_threads.size());
+    // The threads that are asleep still do the same step.
+    thi_type const thread_end(m_threads.size());
+    for (thi_type sleeping_thi(0); sleeping_thi < thread_end; ++sleeping_thi)
+      if ((sleep & index2mask(sleeping_thi)).any())
+        m_footprints[si][sleeping_thi] = m_footprints[si - 1][sleeping_thi];
+  }
+}
+
+namespace {
+
+uint64_t mix(uint64_t hash, uint64_t value)
+{
+  // The finalizer of splitmix64.
+  hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+} // namespace
+
+uint64_t Permutation::state_key() const
+{
+  uint64_t key = m_state_hash();
+  thi_type const thread_end(m_threads.size());
+  for (thi_type thi(0); thi < thread_end; ++thi)
+  {
+    threads_set_type const thm = index2mask(thi);
+    if ((m_running_threads & thm).none())
+    {
+      key = mix(key, 0);
+      continue;
+    }
+    Thread const& thread(m_threads[thi]);
+    key = mix(key, 1 + (m_blocked_threads & thm).any() + 2 * (m_waiting_threads & thm).any() + 4 * (m_woken_threads & thm).any());
+    key = mix(key, thread.checkpoint_site().id());
+  }
+  return key;
+}
+
+void Permutation::prune_visited_state()
+{
+  // The state after step si.
+  int const si = m_current_step - 1;
+  // Only look at states that weren't reached by the previous play() too, and only where there is something left to vary.
+  if (si < m_first_new_step || si + 1 >= m_prune_depth || m_running_threads.none() || m_running_threads.is_single_bit())
+    return;
+  if (m_visited_states.visit(state_key(), si + 1))
+  {
+    Dout(dc::permutation, "The state after step " << si << " was visited before; pruning.");
+    m_prune_depth = si + 1;
+  }
+}
+
+void Permutation::clear_steps()
 {
   m_steps.clear();
-  m_blocked.clear();
-  m_waiting.clear();
-  m_woken.clear();
+  m_done.clear();
+  m_backtrack.clear();
+  m_sleep.clear();
+  m_footprints.clear();
+}
+
+void Permutation::program(std::string const& steps)
+{
+  clear_steps();
+  m_prune_depth = std::numeric_limits<int>::max();
+  m_first_new_step = 0;
+  m_floor = 0;
+  m_bound_exceeded = false;
   m_running_threads.reset();
   m_blocked_threads.reset();
   m_waiting_threads.reset();
   m_woken_threads.reset();
-  for (auto c : steps)
+  m_program.assign(steps);
+}
+
+namespace {
+
+template<typename T>
+void append(std::string& out, T const& value)
+{
+  static_assert(std::is_trivially_copyable_v<T>, "Can only serialize trivially copyable types.");
+  out.append(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+template<typename T>
+T extract(std::string const& in, size_t& pos)
+{
+  T value;
+  // The state may have been read from a file.
+  if (in.size() - pos < sizeof(T))
+    DoutFatal(dc::core, "The search state is truncated.");
+  std::memcpy(&value, in.data() + pos, sizeof(T));
+  pos += sizeof(T);
+  return value;
+}
+
+} // namespace
+
+std::string Permutation::search_state() const
+{
+  std::string out;
+  append(out, m_first_new_step);
+  append(out, m_floor);
+  append(out, m_steps.size());
+  for (size_t si = 0; si < m_steps.size(); ++si)
+  {
+    append(out, m_steps[si]);
+    append(out, m_done[si]);
+    append(out, m_backtrack[si]);
+    append(out, m_sleep[si]);
+  }
+  append(out, m_footprints.size());
+  for (footprints_type const& footprints : m_footprints)
+  {
+    append(out, footprints.size());
+    for (Footprint const& footprint : footprints)
+    {
+      append(out, footprint.unknown());
+      append(out, footprint.accesses().size());
+      for (Footprint::Access const& access : footprint.accesses())
+        append(out, access);
+    }
+  }
+  return out;
+}
+
+void Permutation::set_search_state(std::string const& state)
+{
+  size_t pos = 0;
+  m_first_new_step = extract<int>(state, pos);
+  m_floor = extract<int>(state, pos);
+  size_t const number_of_steps = extract<size_t>(state, pos);
+  // Check the sizes before allocating anything for them.
+  if (number_of_steps > (state.size() - pos) / (sizeof(StepRecord) + 3 * sizeof(threads_set_type)))
+    DoutFatal(dc::core, "The search state is corrupt: it can't contain " << number_of_steps << " steps.");
+  if (m_first_new_step < 0 || static_cast<size_t>(m_first_new_step) > number_of_steps || m_floor < 0 || static_cast<size_t>(m_floor) > number_of_steps)
+    DoutFatal(dc::core, "The search state is corrupt: step " << m_first_new_step << " or floor " << m_floor << " is out of range.");
+  clear_steps();
+  for (size_t si = 0; si < number_of_steps; ++si)
+  {
+    m_steps.push_back(extract<StepRecord>(state, pos));
+    if (m_steps.back().m_thi.get_value() >= m_threads.size())
+      DoutFatal(dc::core, "The search state is corrupt: step " << si << " is done by a thread that doesn't exist.");
+    m_done.push_back(extract<threads_set_type>(state, pos));
+    m_backtrack.push_back(extract<threads_set_type>(state, pos));
+    m_sleep.push_back(extract<threads_set_type>(state, pos));
+  }
+  size_t const number_of_footprints = extract<size_t>(state, pos);
+  if (number_of_footprints > (state.size() - pos) / sizeof(size_t))
+    DoutFatal(dc::core, "The search state is corrupt: it can't contain " << number_of_footprints << " footprints.");
+  for (size_t si = 0; si < number_of_footprints; ++si)
   {
-    size_t thread_id = c - '0';
-    m_steps.push_back(ThreadIndex(thread_id));
+    size_t const number_of_threads = extract<size_t>(state, pos);
+    // An entry is either empty (resized) or has a footprint per thread.
+    if (number_of_threads != 0 && number_of_threads != m_threads.size())
+      DoutFatal(dc::core, "The search state is corrupt: it has footprints of " << number_of_threads << " threads.");
+    m_footprints.emplace_back(number_of_threads);
+    for (Footprint& footprint : m_footprints.back())
+    {
+      bool const unknown = extract<bool>(state, pos);
+      size_t const number_of_accesses = extract<size_t>(state, pos);
+      if (number_of_accesses > (state.size() - pos) / sizeof(Footprint::Access))
+        DoutFatal(dc::core, "The search state is corrupt: it can't contain " << number_of_accesses << " accesses.");
+      if (!unknown)
+        footprint.mark_local();
+      for (size_t i = 0; i < number_of_accesses; ++i)
+      {
+        Footprint::Access const access = extract<Footprint::Access>(state, pos);
+        footprint.add(access.m_object, access.m_write);
+      }
+    }
   }
+  if (pos != state.size())
+    DoutFatal(dc::core, "The search state is corrupt: " << (state.size() - pos) << " bytes are left over.");
 }
 
 std::ostream& operator<<(std::ostream& os, Permutation const& permutation)
 {
   os << "Steps:";
-  for (auto s : permutation.m_steps)
-    os << ' ' << s;
+  for (auto const& step : permutation.m_steps)
+    os << ' ' << step.m_thi;
   os << "; running: " << permutation.m_running_threads << "; blocked: " << permutation.m_blocked_threads <<
     "; waiting: " << permutation.m_waiting_threads << "; woken: " << permutation.m_woken_threads;
   return os;
@@ -1,12 +1,16 @@
 #pragma once
 
 #include "ThreadPermuter.h"
+#include "VisitedStates.h"
+#include "Schedule.h"
 #include "utils/BitSet.h"
 #include <vector>
 #include <set>
 #include <iosfwd>
 #include <cstdint>
 #include <string>
+#include <limits>
+#include <functional>
 
 namespace thread_permuter {
 
@@ -14,29 +18,137 @@ class Permutation
 {
  public:
   using thi_type = ThreadPermuter::thi_type;
+  using footprints_type = utils::Vector<Footprint, thi_type>;
 
-  Permutation(ThreadPermuter::threads_type& threads) : m_threads(threads), m_running_threads(0), m_debug_on(false) { }
+  Permutation(ThreadPermuter::threads_type& threads) :
+    m_threads(threads), m_program(threads.size()), m_running_threads(0), m_current_step(0), m_first_new_step(0), m_floor(0), m_prune_depth(std::numeric_limits<int>::max()),
+    m_preemptions(0), m_preemption_bound(-1), m_bound_exceeded(false), m_dpor(false), m_sleep_sets(false), m_dead_locked(false), m_redundant(false), m_debug_on(false) { }
 
-  bool step(thi_type thi, std::string& permutation_string);     // Play a single step on thread thi.
-  void play(std::string& permutation_string, bool run_complete = true);
-                                                                // Play the whole recorded permutation (if run_complete is false only play what is in m_steps).
-  void complete(std::string& permutation_string);               // Complete a play()-ed permutation.
+  // The steps that are played are appended to schedule.
+  bool step(thi_type thi, Schedule& schedule);                  // Play a single step on thread thi.
+  void play(Schedule& schedule, bool run_complete = true);      // Play the whole recorded permutation (if run_complete is false only play what is in m_steps).
+  void complete(Schedule& schedule);                            // Complete a play()-ed permutation.
+  void finish(Schedule& schedule);                              // After a failure, run the other threads to completion.
+  bool dead_locked() const { return m_dead_locked; }            // Returns true if the last play() ended in a dead lock.
   bool next(int limit);                                         // Prepare for the next play(). Returns false when there isn't one.
 
   // Program a given permutation.
   void program(std::string const& steps);
 
+  // Only backtrack at steps that conflict according to their Footprint (dynamic partial-order reduction).
+  void set_dpor(bool dpor) { m_dpor = dpor; }
+
+  // Do not run threads whose next step is independent of everything that was run since the same step was already tried.
+  void set_sleep_sets(bool sleep_sets) { m_sleep_sets = sleep_sets; }
+
+  // Only explore permutations with at most preemption_bound preemptions (or all when negative).
+  void set_preemption_bound(int preemption_bound) { m_preemption_bound = preemption_bound; }
+  int preemptions() const { return m_preemptions; }             // The number of preemptions of the last play().
+  // Returns true if the last play() was already explored with a smaller preemption bound.
+  bool already_covered() const { return m_preemptions < m_preemption_bound; }
+  // Returns true if next() skipped permutations because they have more preemptions than the bound.
+  bool bound_exceeded() const { return m_bound_exceeded; }
+
+  // Returns true if the last play() ran into a state where all threads that could run were asleep.
+  bool redundant() const { return m_redundant; }
+
+  // Threads with the same class run identical test functions (classes[thi] is the class of thread thi).
+  // Of the threads of a class that didn't do any step yet, only the one with the lowest index may run,
+  // so that every permutation is only explored once instead of once for every relabeling of those threads.
+  void set_symmetry_classes(std::vector<int> const& classes);
+
+  // Do not vary the steps after reaching a state that was already visited before.
+  // The state is identified by the value returned by state_hash, the checkpoint that every running thread is at and which threads are blocked or waiting.
+  void set_state_hash(std::function<uint64_t()> state_hash) { m_state_hash = std::move(state_hash); }
+  VisitedStates const& visited_states() const { return m_visited_states; }
+
+  // The index of the first step that was changed by the last call to next().
+  int first_new_step() const { return m_first_new_step; }
+
+  // Never change the first floor steps (used to explore only the permutations that start with a given prefix).
+  void set_floor(int floor) { m_floor = floor; }
+  int floor() const { return m_floor; }
+  std::string floor_prefix() const;                             // The steps below the floor, as permutation string.
+  bool split(int limit, std::vector<std::string>& prefixes);   // Give away part of the remaining permutations.
+
+  // Call hook before playing a new step si at which more than one thread can run.
+  // The hook returns true when it replaced the search state (see set_search_state) and the
+  // current play must continue with the (new) steps from si on (see ThreadPermuter::set_snapshots).
+  void set_snapshot_hook(std::function<bool(int)> hook) { m_snapshot_hook = std::move(hook); }
+  // Let chooser pick the thread that runs next in complete(), instead of the one with the lowest index.
+  // It is passed the threads that can run and the index of the new step.
+  void set_chooser(std::function<thi_type(threads_set_type, int)> chooser) { m_chooser = std::move(chooser); }
+  // The number of steps done by the last play().
+  int number_of_steps() const { return m_current_step; }
+
+  // Everything that next() needs to continue the search, in binary form.
+  // The footprints of sleep sets contain addresses, so those only make sense in (a fork of) the same process.
+  std::string search_state() const;
+  void set_search_state(std::string const& state);
+
  private:
+  void replay(Schedule& schedule, bool run_complete);           // Play the steps from m_current_step on.
+  bool snapshot(int si);                                        // Call m_snapshot_hook if si is a new branch point.
+  bool next_dpor(int limit);                                    // The implementation of next() when m_dpor is set.
+  bool next_bounded(int limit);                                 // The implementation of next() when m_preemption_bound is set.
+  void backtrack_to(int si, thi_type thi);                      // Replace step si with thi and drop the steps after it.
+  void update_backtrack_sets(int limit);                        // Add the alternatives that reverse a race in m_trace to m_backtrack.
+  threads_set_type sleep_set(int si) const;                     // Calculate the sleep set for a new step si.
+  threads_set_type symmetric_threads() const;                   // The threads that may not run now because of their symmetry class.
+  void push_step(thi_type thi, threads_set_type sleep);         // Append thi to m_steps, recording the current state.
+  void clear_steps();                                           // Forget all recorded steps.
+  uint64_t state_key() const;                                   // Return a hash of the current state.
+  void prune_visited_state();                                   // Update m_prune_depth if the state after the last step was visited before.
+  std::string describe_dead_lock() const;                       // What every running thread waits for, and the wait-for cycle.
+  [[noreturn]] void dead_lock(Schedule const& schedule);        // Abandon the running threads and throw a PermutationFailure.
+
+  struct StepRecord
+  {
+    thi_type m_thi;                             // The thread that did this step.
+    threads_set_type m_blocked;                 // The blocked threads just prior to this step.
+    threads_set_type m_waiting;                 // The waiting threads just prior to this step.
+    threads_set_type m_woken;                   // The woken threads just prior to this step.
+    threads_set_type m_symmetric;               // The threads that may not run at this step (see set_symmetry_classes).
+  };
+
+  struct TraceStep
+  {
+    thi_type m_thi;                             // The thread that did this step.
+    threads_set_type m_enabled;                 // The threads that could have been run instead (including m_thi).
+    Footprint m_footprint;                      // The accesses done by this step.
+  };
+
   ThreadPermuter::threads_type& m_threads;      // A reference to the list of Thread objects.
 
-  std::vector<thi_type> m_steps;                // Contains a list of thread indices that did a step;
-  std::vector<threads_set_type> m_blocked;      // The blocked threads just prior to the corresponding step;
-  std::vector<threads_set_type> m_waiting;      // The waiting threads just prior to the corresponding step;
-  std::vector<threads_set_type> m_woken;        // The woken threads just prior to the corresponding step;
+  Schedule m_program;                           // The steps passed to program() that weren't played yet.
+  std::vector<StepRecord> m_steps;              // The thread that did each step, and the state just prior to it;
+  std::vector<threads_set_type> m_done;         // DPOR: the threads that were already tried at the corresponding step;
+  std::vector<threads_set_type> m_backtrack;    // DPOR: the threads that must be tried at the corresponding step;
+  std::vector<TraceStep> m_trace;               // Every step of the last play(), including the ones done by complete() (only with DPOR or sleep sets).
+  std::vector<threads_set_type> m_sleep;        // The threads that are asleep just prior to the corresponding step;
+  std::vector<footprints_type> m_footprints;    // The Footprint of the step that each thread does at the corresponding step (if known).
   threads_set_type m_running_threads;           // A list of thread indices that are still running after the last step in m_steps.
   threads_set_type m_blocked_threads;           // A list of thread indices that are currently blocked on trying to lock a mutex.
   threads_set_type m_waiting_threads;           // A list of thread indices that are currently waiting on a condition variable.
   threads_set_type m_woken_threads;             // A copy of m_waiting_threads made when notify_one is called.
+  threads_set_type m_started_threads;           // The threads that did at least one step.
+  utils::Vector<threads_set_type, thi_type> m_lower_symmetric; // For each thread, the threads of the same symmetry class with a lower index (empty if not used).
+  int m_current_step;                           // The number of steps done by the current play().
+  int m_first_new_step;                         // The index of the first step that differs from the previous play().
+  int m_floor;                                  // Steps with an index less than this are never changed by next().
+  int m_prune_depth;                            // Steps at and beyond this index of m_steps are not varied by the next call to next().
+  thi_type m_last_thi;                          // The thread that did the last step.
+  int m_preemptions;                            // The number of preemptions done by the current play().
+  int m_preemption_bound;                       // The maximum number of preemptions, or -1 if there is no bound.
+  bool m_bound_exceeded;                        // Set when next() skipped a permutation because of m_preemption_bound.
+  std::function<uint64_t()> m_state_hash;       // If set, returns a hash of the user state.
+  VisitedStates m_visited_states;               // The states that were visited (only used when m_state_hash is set).
+  std::function<bool(int)> m_snapshot_hook;     // If set, called at new branch points.
+  std::function<thi_type(threads_set_type, int)> m_chooser; // If set, chooses the next thread in complete().
+  bool m_dpor;                                  // Set when using dynamic partial-order reduction.
+  bool m_sleep_sets;                            // Set when using sleep sets.
+  bool m_dead_locked;                           // Set when all running threads were blocked; they were abandoned.
+  bool m_redundant;                             // Set when the last play() was only done to finish the running threads.
 
  public:
   bool m_debug_on;
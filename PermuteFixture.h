@@ -0,0 +1,96 @@
+#pragma once
+
+#include "ThreadPermuter.h"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// The scenario of permute_test, for the tests that explore it in different ways and compare the outcome:
+// three threads that each change x (which starts at 1) while holding m_mutex; thread 0 adds 7,
+// thread 1 multiplies by 3 and thread 2 takes the remainder of a division by 5.
+struct PermuteFixture
+{
+  thread_permuter::Mutex m_mutex;
+  thread_permuter::Mutex m_y_mutex;
+  int x;
+  int y;
+  bool m_fail_on_zero = false;          // If set, thread 2 fails when x becomes 0 (thread 1, 0 and 2 took the mutex in that order).
+  bool m_independent_step = false;      // If set, thread 2 first changes y while holding m_y_mutex; that step
+                                        // is independent of the other threads.
+  int m_number_of_permutations = 0;
+  std::set<int> m_results;              // The values of x at the end of the permutations.
+
+  void on_permutation_begin() { x = 1; y = 1; }
+  void on_permutation_end(std::string const& /*permutation_string*/) { ++m_number_of_permutations; m_results.insert(x); }
+
+  // The change to x of thread n.
+  void apply(int n)
+  {
+    switch (n)
+    {
+      case 0:
+        x += 7;
+        break;
+      case 1:
+        x *= 3;
+        break;
+      case 2:
+        x %= 5;
+        TP_ASSERT(!m_fail_on_zero || x != 0);
+        break;
+    }
+  }
+
+  // The test function of thread n.
+  void test(int n)
+  {
+    if (n == 2 && m_independent_step)
+    {
+      m_y_mutex.lock();
+      y = 2 * y + 1;
+      m_y_mutex.unlock();
+      TPY;
+    }
+
+    m_mutex.lock();
+    TPY;
+
+    apply(n);
+    TPY;
+
+    m_mutex.unlock();
+    TPY;
+  }
+
+  ThreadPermuter::tests_type tests()
+  {
+    return { [this]{ test(0); }, [this]{ test(1); }, [this]{ test(2); } };
+  }
+};
+
+// What an exploration of the fixture did.
+struct Exploration
+{
+  int m_number_of_permutations;
+  std::set<int> m_results;
+};
+
+// Explore a new fixture once for every mode, with explore(mode, fixture), and print and return what each exploration did.
+inline std::vector<Exploration> explore_modes(std::vector<char const*> const& modes, std::function<void(int, PermuteFixture&)> const& explore)
+{
+  std::vector<Exploration> explorations;
+  for (int mode = 0; mode < static_cast<int>(modes.size()); ++mode)
+  {
+    PermuteFixture fixture;
+    auto start = std::chrono::steady_clock::now();
+    explore(mode, fixture);
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    std::cout << modes[mode] << ": " << fixture.m_number_of_permutations << " permutations, " << fixture.m_results.size() <<
+      " different results, in " << duration.count() << " seconds." << std::endl;
+    explorations.push_back({ fixture.m_number_of_permutations, fixture.m_results });
+  }
+  return explorations;
+}
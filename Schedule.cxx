@@ -0,0 +1,86 @@
+#include "sys.h"
+#include "Schedule.h"
+#include <iostream>
+
+namespace thread_permuter {
+
+namespace {
+
+char const* const thread_characters = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+constexpr size_t number_of_thread_characters = 62;
+
+} // namespace
+
+char thi_to_char(ThreadIndex thi)
+{
+  if (thi.get_value() >= number_of_thread_characters)
+    return '?';
+  return thread_characters[thi.get_value()];
+}
+
+ThreadIndex char_to_thi(char c)
+{
+  if (c >= '0' && c <= '9')
+    return ThreadIndex(c - '0');
+  if (c >= 'a' && c <= 'z')
+    return ThreadIndex(c - 'a' + 10);
+  // Anything else is an illegal permutation string.
+  ASSERT(c >= 'A' && c <= 'Z');
+  return ThreadIndex(c - 'A' + 36);
+}
+
+void append_thi(std::string& permutation_string, ThreadIndex thi)
+{
+  if (thi.get_value() < number_of_thread_characters)
+    permutation_string += thread_characters[thi.get_value()];
+  else
+    permutation_string += '{' + std::to_string(thi.get_value()) + '}';
+}
+
+ThreadIndex extract_thi(std::string const& permutation_string, size_t& pos)
+{
+  if (permutation_string[pos] != '{')
+    return char_to_thi(permutation_string[pos++]);
+  size_t const end = permutation_string.find('}', pos);
+  ASSERT(end != std::string::npos);
+  ThreadIndex thi(std::stoul(permutation_string.substr(pos + 1, end - pos - 1)));
+  pos = end + 1;
+  return thi;
+}
+
+void Schedule::assign(std::string const& permutation_string)
+{
+  clear();
+  size_t pos = 0;
+  while (pos < permutation_string.size())
+    push_back(extract_thi(permutation_string, pos));
+}
+
+std::string Schedule::str(int size) const
+{
+  std::string result;
+  copy_to(result, size);
+  return result;
+}
+
+void Schedule::copy_to(std::string& permutation_string, int size) const
+{
+  if (size < 0)
+    size = m_size;
+  permutation_string.clear();
+  permutation_string.reserve(size);
+  for (int si = 0; si < size; ++si)
+    append_thi(permutation_string, (*this)[si]);
+}
+
+std::ostream& operator<<(std::ostream& os, Schedule const& schedule)
+{
+  return os << schedule.str();
+}
+
+std::ostream& operator<<(std::ostream& os, ScheduleView const& schedule_view)
+{
+  return os << schedule_view.str();
+}
+
+} // namespace thread_permuter
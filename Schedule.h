@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Thread.h"
+#include <vector>
+#include <string>
+#include <iosfwd>
+#include <cstdint>
+
+namespace thread_permuter {
+
+// Convert a thread index to the character that represents it in a permutation string and back.
+// The threads are represented by '0'-'9', 'a'-'z' and 'A'-'Z', in that order; thi_to_char returns '?' for larger indices.
+char thi_to_char(ThreadIndex thi);
+ThreadIndex char_to_thi(char c);
+// Append thread index thi to a permutation string. Indices that don't have a character are written as "{index}".
+void append_thi(std::string& permutation_string, ThreadIndex thi);
+// Read the thread index at position pos of a permutation string and advance pos.
+ThreadIndex extract_thi(std::string const& permutation_string, size_t& pos);
+
+// The threads that did the steps of a permutation, packed into 4 bits per step (8 bits when there are more than 16 threads).
+// Up to 256 threads are supported.
+//
+// clear() keeps the buffer, so recording a permutation doesn't allocate memory once
+// the buffer grew large enough for the longest permutation.
+class Schedule
+{
+ public:
+  static constexpr int max_nibble_threads = 16;         // The number of threads that fit in 4 bits.
+
+ private:
+  std::vector<uint8_t> m_data;          // The packed steps; two steps per byte (low nibble first) unless m_wide.
+  int m_size;                           // The number of steps.
+  bool m_wide;                          // Set when every step uses a whole byte.
+
+ public:
+  explicit Schedule(int number_of_threads = max_nibble_threads) : m_size(0), m_wide(number_of_threads > max_nibble_threads) { }
+
+  int size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  void clear() { m_size = 0; }
+
+  void push_back(ThreadIndex thi)
+  {
+    uint8_t const value = thi.get_value();
+    if (m_wide)
+    {
+      if (m_size == static_cast<int>(m_data.size()))
+        m_data.push_back(value);
+      else
+        m_data[m_size] = value;
+    }
+    else if (m_size % 2 == 0)
+    {
+      if (m_size / 2 == static_cast<int>(m_data.size()))
+        m_data.push_back(value);
+      else
+        m_data[m_size / 2] = value;
+    }
+    else
+      m_data[m_size / 2] |= value << 4;
+    ++m_size;
+  }
+
+  ThreadIndex operator[](int si) const
+  {
+    if (m_wide)
+      return ThreadIndex(m_data[si]);
+    return ThreadIndex((m_data[si / 2] >> (4 * (si % 2))) & 0xf);
+  }
+
+  // Replace the content with the steps of a permutation string.
+  void assign(std::string const& permutation_string);
+  // Return the first size steps (by default all of them) as permutation string.
+  std::string str(int size = -1) const;
+  // Like str, but overwrite permutation_string; this doesn't allocate memory once permutation_string is large enough.
+  void copy_to(std::string& permutation_string, int size = -1) const;
+};
+
+// A read-only view of (the first steps of) a Schedule, which is what is passed to the on_permutation_end callback.
+//
+// Converting the view to a permutation string allocates memory, so that must be asked for explicitly.
+class ScheduleView
+{
+ private:
+  Schedule const* m_schedule;
+  int m_size;
+
+ public:
+  ScheduleView(Schedule const& schedule) : m_schedule(&schedule), m_size(schedule.size()) { }
+
+  int size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  ThreadIndex operator[](int si) const { return (*m_schedule)[si]; }
+  // The first size steps, like std::span::first.
+  ScheduleView first(int size) const { ScheduleView result(*this); result.m_size = size; return result; }
+
+  std::string str() const { return m_schedule->str(m_size); }
+  void copy_to(std::string& permutation_string) const { m_schedule->copy_to(permutation_string, m_size); }
+  explicit operator std::string() const { return str(); }
+};
+
+std::ostream& operator<<(std::ostream& os, Schedule const& schedule);
+std::ostream& operator<<(std::ostream& os, ScheduleView const& schedule_view);
+
+} // namespace thread_permuter
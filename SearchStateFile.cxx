@@ -0,0 +1,132 @@
+#include "sys.h"
+#include "SearchStateFile.h"
+#include "Permutation.h"
+#include "debug.h"
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace thread_permuter {
+
+namespace {
+
+char const* const magic = "threadpermuter search state 3";
+
+// Write data to path and make sure it is on disk before returning.
+void write_durably(std::string const& path, std::string const& data)
+{
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+    DoutFatal(dc::core|error_cf, "open(\"" << path << "\")");
+  size_t written = 0;
+  while (written < data.size())
+  {
+    ssize_t len = ::write(fd, data.data() + written, data.size() - written);
+    if (len == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      DoutFatal(dc::core|error_cf, "write(\"" << path << "\")");
+    }
+    written += len;
+  }
+  if (fsync(fd) == -1)
+    DoutFatal(dc::core|error_cf, "fsync(\"" << path << "\")");
+  close(fd);
+}
+
+// Make a rename in the directory of path durable.
+void sync_directory(std::string const& path)
+{
+  size_t const slash = path.rfind('/');
+  std::string const directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+  int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+  fsync(fd);
+  close(fd);
+}
+
+} // namespace
+
+SearchStateFile::SearchStateFile(std::string const& path, clock_type::duration interval, Configuration const& configuration) :
+  m_path(path), m_interval(interval), m_last_write(clock_type::now()), m_configuration(configuration),
+  m_previous_permutations(0), m_previous_redundant_permutations(0)
+{
+}
+
+bool SearchStateFile::load(Permutation& permutation)
+{
+  std::ifstream file(m_path, std::ios::binary);
+  if (!file)
+    return false;
+  std::string header;
+  std::getline(file, header);
+  if (header.compare(0, std::strlen(magic), magic) != 0)
+    DoutFatal(dc::core, "\"" << m_path << "\" is not a threadpermuter search state file.");
+  std::istringstream fields(header.substr(std::strlen(magic)));
+  Configuration configuration;
+  size_t search_state_size;
+  int file_max_threads;
+  size_t set_width;
+  fields >> file_max_threads >> set_width >> configuration.m_number_of_threads >> configuration.m_limit >> configuration.m_dpor >> configuration.m_sleep_sets >> configuration.m_symmetry >>
+    m_previous_permutations >> m_previous_redundant_permutations >> search_state_size;
+  if (!fields)
+    DoutFatal(dc::core, "\"" << m_path << "\" has a corrupt header.");
+  // The state contains sets of threads as they are in memory.
+  if (file_max_threads != max_threads || set_width != sizeof(threads_set_type))
+    DoutFatal(dc::core, "\"" << m_path << "\" was written by a build with THREADPERMUTER_MAX_THREADS=" << file_max_threads <<
+        " (sets of " << set_width << " bytes), this is " << max_threads << " (sets of " << sizeof(threads_set_type) << " bytes).");
+  // Resuming with a different test or configuration would skip the wrong permutations.
+  if (configuration.m_number_of_threads != m_configuration.m_number_of_threads || configuration.m_limit != m_configuration.m_limit ||
+      configuration.m_dpor != m_configuration.m_dpor || configuration.m_sleep_sets != m_configuration.m_sleep_sets ||
+      configuration.m_symmetry != m_configuration.m_symmetry)
+    DoutFatal(dc::core, "\"" << m_path << "\" was written with a different configuration.");
+  // The footprints of sleep sets refer to objects of the process that wrote the file.
+  if (configuration.m_sleep_sets)
+    DoutFatal(dc::core, "\"" << m_path << "\" was written with sleep sets, which can't be resumed.");
+  // Don't trust search_state_size before it's known that the file is that large.
+  std::string const search_state{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+  if (search_state.size() != search_state_size)
+    DoutFatal(dc::core, "\"" << m_path << "\" is truncated.");
+  permutation.set_search_state(search_state);
+  Dout(dc::notice, "Resuming from \"" << m_path << "\" after " << m_previous_permutations << " permutations.");
+  return true;
+}
+
+void SearchStateFile::update(Permutation const& permutation, int number_of_permutations, int number_of_redundant_permutations)
+{
+  clock_type::time_point const now = clock_type::now();
+  if (now - m_last_write < m_interval)
+    return;
+  m_last_write = now;
+  write(permutation, number_of_permutations, number_of_redundant_permutations);
+}
+
+void SearchStateFile::write(Permutation const& permutation, int number_of_permutations, int number_of_redundant_permutations)
+{
+  std::string const search_state = permutation.search_state();
+  std::ostringstream header;
+  header << magic << ' ' << max_threads << ' ' << sizeof(threads_set_type) << ' ' << m_configuration.m_number_of_threads << ' ' << m_configuration.m_limit << ' ' <<
+    m_configuration.m_dpor << ' ' << m_configuration.m_sleep_sets << ' ' << m_configuration.m_symmetry << ' ' <<
+    (m_previous_permutations + number_of_permutations) << ' ' << (m_previous_redundant_permutations + number_of_redundant_permutations) << ' ' <<
+    search_state.size() << '\n';
+  std::string const temporary = m_path + ".tmp";
+  write_durably(temporary, header.str() + search_state);
+  if (std::rename(temporary.c_str(), m_path.c_str()) == -1)
+    DoutFatal(dc::core|error_cf, "rename(\"" << temporary << "\", \"" << m_path << "\")");
+  sync_directory(m_path);
+}
+
+void SearchStateFile::remove()
+{
+  std::remove(m_path.c_str());
+  sync_directory(m_path);
+}
+
+} // namespace thread_permuter
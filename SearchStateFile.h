@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+
+namespace thread_permuter {
+
+class Permutation;
+
+// A file with the search state of an exhaustive run, so that the run can be resumed after a crash.
+//
+// The file contains a header that identifies the build (THREADPERMUTER_MAX_THREADS and the size
+// of a set of threads) and the configuration of the search, the number of permutations played so
+// far and the binary search state of the Permutation as it is after Permutation::next(). Everything
+// that is read back is checked, and a file that doesn't fit is rejected with DoutFatal. It is always replaced as a whole: the new content is written to a
+// temporary file that is fsync-ed and then renamed over the old one.
+class SearchStateFile
+{
+ public:
+  using clock_type = std::chrono::steady_clock;
+
+  // The search configuration that must be the same when resuming.
+  struct Configuration
+  {
+    int m_number_of_threads;
+    int m_limit;
+    bool m_dpor;
+    bool m_sleep_sets;
+    bool m_symmetry;
+  };
+
+ private:
+  std::string m_path;                   // The name of the file.
+  clock_type::duration m_interval;      // The minimum time between two writes.
+  clock_type::time_point m_last_write;  // The time of the last write (or construction).
+  Configuration m_configuration;        // The configuration that is written to the file.
+  int m_previous_permutations;          // The number of permutations that were played before the resumed run.
+  int m_previous_redundant_permutations;// The number of those that were redundant.
+
+ public:
+  SearchStateFile(std::string const& path, clock_type::duration interval, Configuration const& configuration);
+
+  // If the file exists, restore permutation to the state that was saved and return true.
+  bool load(Permutation& permutation);
+  // Save the state of permutation if at least the interval passed since the last write.
+  // The counts are those of the current run only.
+  void update(Permutation const& permutation, int number_of_permutations, int number_of_redundant_permutations);
+  // Remove the file (after the search finished).
+  void remove();
+
+  int previous_permutations() const { return m_previous_permutations; }
+  int previous_redundant_permutations() const { return m_previous_redundant_permutations; }
+
+ private:
+  void write(Permutation const& permutation, int number_of_permutations, int number_of_redundant_permutations);
+};
+
+} // namespace thread_permuter
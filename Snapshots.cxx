@@ -0,0 +1,267 @@
+#include "sys.h"
+#include "Snapshots.h"
+#include "Permutation.h"
+#include "debug.h"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+namespace thread_permuter {
+
+namespace {
+
+std::string to_hex(std::string const& data)
+{
+  static char const digits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(2 * data.size());
+  for (unsigned char c : data)
+  {
+    hex += digits[c >> 4];
+    hex += digits[c & 0xf];
+  }
+  return hex;
+}
+
+std::string from_hex(std::string const& hex)
+{
+  auto value = [](char c){ return c <= '9' ? c - '0' : c - 'a' + 10; };
+  std::string data;
+  data.reserve(hex.size() / 2);
+  for (size_t i = 0; i + 1 < hex.size(); i += 2)
+    data += static_cast<char>(value(hex[i]) << 4 | value(hex[i + 1]));
+  return data;
+}
+
+} // namespace
+
+Snapshots::Snapshots(int budget) :
+  m_address("unix:/tmp/threadpermuter-snapshots." + std::to_string(getpid())), m_budget(budget), m_listen_fd(-1), m_clock(0), m_done(false),
+  m_number_of_permutations(0), m_number_of_redundant_permutations(0), m_number_of_snapshots(0), m_number_of_resumes(0)
+{
+}
+
+Snapshots::~Snapshots()
+{
+  if (m_listen_fd != -1)
+  {
+    close(m_listen_fd);
+    unlink(m_address.c_str() + 5);
+  }
+}
+
+void Snapshots::connect_to_root(char const* hello)
+{
+  m_root = Connection::connect(m_address);
+  if (m_root.fd() == -1)
+    _exit(1);
+  m_root.send(hello);
+}
+
+void Snapshots::run(std::function<void()> const& explore)
+{
+  DoutEntering(dc::notice, "Snapshots::run()");
+  m_listen_fd = Connection::listen(m_address);
+  if (m_listen_fd == -1)
+    DoutFatal(dc::core|error_cf, "Could not listen on \"" << m_address << "\"");
+  std::cout << std::flush;
+  pid_t const leaf = fork();
+  if (leaf == -1)
+    DoutFatal(dc::core|error_cf, "fork");
+  if (leaf == 0)
+  {
+    close(m_listen_fd);
+    connect_to_root("LEAF");
+    explore();
+    done();
+  }
+
+  while (!m_done)
+  {
+    std::vector<pollfd> fds(1 + m_peers.size());
+    fds[0] = { m_listen_fd, POLLIN, 0 };
+    for (size_t p = 0; p < m_peers.size(); ++p)
+      fds[p + 1] = { m_peers[p].m_connection.fd(), POLLIN, 0 };
+    if (poll(fds.data(), fds.size(), -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      DoutFatal(dc::core|error_cf, "poll");
+    }
+    for (size_t p = 0; p < m_peers.size() && !m_done; ++p)
+    {
+      if (!fds[p + 1].revents || m_peers[p].m_removed)
+        continue;
+      Peer& peer = m_peers[p];
+      std::string message;
+      int res;
+      while (!peer.m_removed && (res = peer.m_connection.read_line(message, false)) == 1)
+        process(peer, message);
+      if (res == -1 && !peer.m_removed)
+      {
+        // A leaf closes its connection after it was told to EXIT, at which point it is no longer in m_peers.
+        Dout(dc::warning, (peer.m_snapshot ? "A snapshot" : "The leaf process") << " died unexpectedly; not all permutations were explored.");
+        peer.m_removed = true;
+        if (!peer.m_snapshot)
+          m_done = true;
+      }
+    }
+    m_peers.erase(std::remove_if(m_peers.begin(), m_peers.end(), [](Peer const& peer){ return peer.m_removed; }), m_peers.end());
+    if ((fds[0].revents & POLLIN))
+    {
+      int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd != -1)
+        m_peers.emplace_back(Connection(fd));
+    }
+  }
+
+  // Let all snapshots exit.
+  for (Peer& peer : m_peers)
+    if (peer.m_snapshot)
+      peer.m_connection.send("QUIT");
+  m_peers.clear();
+  waitpid(leaf, nullptr, 0);
+  Dout(dc::notice, "Took " << m_number_of_snapshots << " snapshots, which were used " << m_number_of_resumes << " times.");
+  for (std::string const& failure : m_failures)
+    TP_REPORT_FAILURE("Permutation \"" << failure.substr(0, failure.find('\t')) << "\" failed assertion " << failure.substr(failure.find('\t') + 1) << ".");
+}
+
+void Snapshots::remove(Peer& peer)
+{
+  peer.m_connection.send("QUIT");
+  peer.m_removed = true;
+}
+
+void Snapshots::process(Peer& peer, std::string const& message)
+{
+  if (message == "LEAF")
+    return;
+  if (message.compare(0, 9, "SNAPSHOT ") == 0)
+  {
+    size_t const space = message.find(' ', 9);
+    peer.m_snapshot = true;
+    peer.m_depth = std::stoi(message.substr(9, space - 9));
+    peer.m_prefix = message.substr(space + 1);
+    peer.m_last_used = ++m_clock;
+    ++m_number_of_snapshots;
+    // Remove the least recently used snapshot when we have too many.
+    int number_of_snapshots = 0;
+    Peer* least_recently_used = nullptr;
+    for (Peer& snapshot : m_peers)
+      if (snapshot.m_snapshot && !snapshot.m_removed)
+      {
+        ++number_of_snapshots;
+        if (!least_recently_used || snapshot.m_last_used < least_recently_used->m_last_used)
+          least_recently_used = &snapshot;
+      }
+    if (number_of_snapshots > m_budget)
+      remove(*least_recently_used);
+  }
+  else if (message.compare(0, 5, "PERM ") == 0)
+  {
+    ++m_number_of_permutations;
+    if (message[5] == '1')
+      ++m_number_of_redundant_permutations;
+  }
+  else if (message.compare(0, 5, "FAIL ") == 0)
+    m_failures.push_back(message.substr(5));
+  else if (message.compare(0, 5, "NEXT ") == 0)
+  {
+    size_t const space = message.find(' ', 5);
+    std::string const state = message.substr(5, space - 5);
+    std::string const prefix = message.substr(space + 1);
+    // Remove the snapshots that are not on the path of the next permutation and find the deepest one that is.
+    Peer* best = nullptr;
+    for (Peer& snapshot : m_peers)
+    {
+      if (!snapshot.m_snapshot || snapshot.m_removed)
+        continue;
+      if (snapshot.m_depth > static_cast<int>(prefix.size()) || prefix.compare(0, snapshot.m_depth, snapshot.m_prefix) != 0)
+        remove(snapshot);
+      else if (!best || snapshot.m_depth > best->m_depth)
+        best = &snapshot;
+    }
+    if (!best)
+    {
+      peer.m_connection.send("RESTART");
+      return;
+    }
+    best->m_connection.send("RESUME " + state);
+    best->m_last_used = ++m_clock;
+    ++m_number_of_resumes;
+    peer.m_connection.send("EXIT");
+    peer.m_removed = true;
+  }
+  else if (message == "DONE")
+  {
+    m_done = true;
+    peer.m_removed = true;
+  }
+  else
+    Dout(dc::warning, "Ignoring unknown message \"" << message << "\".");
+}
+
+bool Snapshots::take(Permutation& permutation, int depth, std::string const& prefix)
+{
+  std::cout << std::flush;
+  pid_t const pid = fork();
+  if (pid == -1)
+  {
+    Dout(dc::warning|error_cf, "fork");
+    return false;
+  }
+  if (pid > 0)
+    return false;       // The leaf continues.
+
+  // This process is the snapshot.
+  connect_to_root(("SNAPSHOT " + std::to_string(depth) + ' ' + prefix).c_str());
+  std::string message;
+  for (;;)
+  {
+    // Reap the leaf processes that were forked from this snapshot.
+    while (waitpid(-1, nullptr, WNOHANG) > 0)
+      ;
+    if (m_root.read_line(message, true) != 1 || message == "QUIT")
+      _exit(0);
+    ASSERT(message.compare(0, 7, "RESUME ") == 0);
+    std::cout << std::flush;
+    pid_t const leaf = fork();
+    if (leaf == 0)
+    {
+      connect_to_root("LEAF");        // First, so that the root notices it when this process dies.
+      permutation.set_search_state(from_hex(message.substr(7)));
+      return true;
+    }
+  }
+}
+
+void Snapshots::finished(bool redundant)
+{
+  m_root.send(redundant ? "PERM 1" : "PERM 0");
+}
+
+void Snapshots::failed(std::string const& permutation, std::string const& message)
+{
+  m_root.send("FAIL " + permutation + '\t' + message);
+}
+
+void Snapshots::next(Permutation& permutation, std::string const& prefix)
+{
+  m_root.send("NEXT " + to_hex(permutation.search_state()) + ' ' + prefix);
+  std::string message;
+  if (m_root.read_line(message, true) != 1 || message == "EXIT")
+    _exit(0);
+  ASSERT(message == "RESTART");
+}
+
+void Snapshots::done()
+{
+  m_root.send("DONE");
+  _exit(0);
+}
+
+} // namespace thread_permuter
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Connection.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace thread_permuter {
+
+class Permutation;
+
+// Forked copies of the process at branch points of the search tree (see ThreadPermuter::set_snapshots).
+//
+// The root process doesn't play any permutations itself. It forks a leaf process that does, and keeps
+// a list of snapshot processes: each was forked by a leaf right before it played a new step at a branch point
+// and is waiting for a message from the root. After playing a permutation, the leaf sends the search
+// state, as it is after Permutation::next(), to the root. The root then lets the deepest snapshot
+// that is still on the path of the next permutation fork a new leaf that continues with that
+// search state, or lets the old leaf replay the next permutation from the start when there is none.
+// Snapshots that are no longer on the path of the search are removed immediately, and when there
+// are more than the budget, the least recently used one is removed.
+//
+// Protocol (one message per line):
+//   leaf -> root: LEAF, PERM <redundant>, FAIL <permutation>\t<message>, NEXT <search state> <prefix>, DONE.
+//   snapshot -> root: SNAPSHOT <depth> <prefix>.
+//   root -> leaf: RESTART, EXIT.
+//   root -> snapshot: RESUME <search state>, QUIT.
+class Snapshots
+{
+ private:
+  // A process connected to the root.
+  struct Peer
+  {
+    Connection m_connection;
+    bool m_snapshot;                    // Set if this is a snapshot; otherwise it is the leaf (or unknown yet).
+    int m_depth;                        // The number of steps that were played by the snapshot.
+    std::string m_prefix;               // Those steps.
+    uint64_t m_last_used;               // When the snapshot was created or last resumed.
+    bool m_removed;                     // Set when the peer must be removed from m_peers.
+
+    Peer(Connection&& connection) : m_connection(std::move(connection)), m_snapshot(false), m_depth(0), m_last_used(0), m_removed(false) { }
+  };
+
+  std::string m_address;                // The address of the socket that the root listens on.
+  int m_budget;                         // The maximum number of snapshots.
+  Connection m_root;                    // Leaf and snapshot processes: the connection with the root.
+
+  // Root process.
+  int m_listen_fd;
+  std::vector<Peer> m_peers;
+  uint64_t m_clock;                     // Incremented every time a snapshot is used.
+  bool m_done;                          // Set when the leaf sent DONE.
+  int m_number_of_permutations;
+  int m_number_of_redundant_permutations;
+  int m_number_of_snapshots;            // The total number of snapshots that were taken.
+  int m_number_of_resumes;              // The number of times that a snapshot was used.
+  std::vector<std::string> m_failures;  // As "permutation\tmessage".
+
+ public:
+  Snapshots(int budget);
+  ~Snapshots();
+
+  // Root side: fork the first leaf, which calls explore, and serve it until all permutations were played.
+  void run(std::function<void()> const& explore);
+
+  int number_of_permutations() const { return m_number_of_permutations; }
+  int number_of_redundant_permutations() const { return m_number_of_redundant_permutations; }
+  int number_of_snapshots() const { return m_number_of_snapshots; }
+  int number_of_resumes() const { return m_number_of_resumes; }
+  std::vector<std::string> const& failures() const { return m_failures; }
+
+  // Leaf side.
+  // Fork a snapshot before playing step depth. Returns true in a new leaf that continues from this snapshot.
+  bool take(Permutation& permutation, int depth, std::string const& prefix);
+  void finished(bool redundant);
+  void failed(std::string const& permutation, std::string const& message);
+  // Called after permutation.next(). Only returns if this process must play the next permutation from the start.
+  void next(Permutation& permutation, std::string const& prefix);
+  [[noreturn]] void done();
+
+ private:
+  void process(Peer& peer, std::string const& message);
+  void remove(Peer& peer);
+  void connect_to_root(char const* hello);
+};
+
+} // namespace thread_permuter
@@ -0,0 +1,238 @@
+#include "sys.h"
+#include "TestRunner.h"
+#include "debug.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/wait.h>
+
+namespace thread_permuter {
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+std::vector<TestCase>& registry()
+{
+  static std::vector<TestCase> tests;
+  return tests;
+}
+
+// A test process that is still running.
+struct Child
+{
+  pid_t m_pid;
+  size_t m_index;                       // The index of the test into the result vector.
+  std::string m_output_path;            // The file that stdout and stderr of the child are redirected to.
+  std::string m_statistics_path;        // The value of THREADPERMUTER_STATISTICS in the child.
+  clock_type::time_point m_start;
+};
+
+std::string read_file(std::string const& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+// Add the permutations of every run() in a THREADPERMUTER_STATISTICS file (see ThreadPermuter::write_statistics).
+long count_permutations(std::string const& path)
+{
+  long permutations = 0;
+  std::ifstream statistics(path);
+  std::string line;
+  while (std::getline(statistics, line))
+  {
+    long p;
+    if (std::sscanf(line.c_str(), "{\"permutations\": %ld,", &p) == 1)
+      permutations += p;
+  }
+  return permutations;
+}
+
+Child start_child(TestCase const& test, size_t index)
+{
+  std::string const base = "/tmp/threadpermuter-test." + std::to_string(getpid()) + '.' + std::to_string(index);
+  Child child{0, index, base + ".out", base + ".stat", clock_type::now()};
+  std::remove(child.m_statistics_path.c_str());
+  // Flush before forking, or buffered output would be written more than once.
+  std::cout.flush();
+  std::cerr.flush();
+  child.m_pid = fork();
+  if (child.m_pid == -1)
+    DoutFatal(dc::core|error_cf, "fork");
+  if (child.m_pid == 0)
+  {
+    if (!std::freopen(child.m_output_path.c_str(), "w", stdout))
+      _exit(126);
+    dup2(1, 2);
+    setenv("THREADPERMUTER_STATISTICS", child.m_statistics_path.c_str(), 1);
+    try
+    {
+      test.m_function();
+    }
+    catch (std::exception const& error)
+    {
+      std::cout << "Uncaught exception: " << error.what() << std::endl;
+      std::exit(1);
+    }
+    std::exit(0);
+  }
+  return child;
+}
+
+void finish_child(Child const& child, int status, TestResult& result)
+{
+  std::chrono::duration<double> const duration = clock_type::now() - child.m_start;
+  result.m_seconds = duration.count();
+  result.m_passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (result.m_passed)
+    result.m_status = "passed";
+  else if (WIFEXITED(status))
+    result.m_status = "exit status " + std::to_string(WEXITSTATUS(status));
+  else
+    result.m_status = std::string("signal ") + std::to_string(WTERMSIG(status)) + " (" + strsignal(WTERMSIG(status)) + ")";
+  result.m_output = read_file(child.m_output_path);
+  result.m_permutations = count_permutations(child.m_statistics_path);
+  std::remove(child.m_output_path.c_str());
+  std::remove(child.m_statistics_path.c_str());
+}
+
+} // namespace
+
+TestRegistration::TestRegistration(char const* name, char const* file, int line, void (*function)())
+{
+  registry().push_back({name, function, file, line});
+}
+
+TestRegistration::TestRegistration(char const* name, char const* file, int line, void (*function)(int), std::initializer_list<int> parameters)
+{
+  for (int parameter : parameters)
+    registry().push_back({std::string(name) + '(' + std::to_string(parameter) + ')', [function, parameter]{ function(parameter); }, file, line});
+}
+
+std::vector<TestCase> const& registered_tests()
+{
+  return registry();
+}
+
+std::vector<TestResult> run_tests(std::vector<std::string> const& filters, int jobs, std::function<void(TestResult const&)> on_result)
+{
+  std::vector<TestCase const*> selected;
+  for (TestCase const& test : registry())
+  {
+    bool match = filters.empty();
+    for (std::string const& filter : filters)
+      if (test.m_name.find(filter) != std::string::npos)
+        match = true;
+    if (match)
+      selected.push_back(&test);
+  }
+
+  std::vector<TestResult> results(selected.size());
+  std::vector<Child> running;
+  size_t next = 0;
+  while (next < selected.size() || !running.empty())
+  {
+    // Keep jobs processes busy.
+    while (next < selected.size() && static_cast<int>(running.size()) < std::max(jobs, 1))
+    {
+      results[next].m_name = selected[next]->m_name;
+      running.push_back(start_child(*selected[next], next));
+      ++next;
+    }
+    int status;
+    pid_t pid = wait(&status);
+    if (pid == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      DoutFatal(dc::core|error_cf, "wait");
+    }
+    auto child = std::find_if(running.begin(), running.end(), [pid](Child const& child){ return child.m_pid == pid; });
+    if (child == running.end())
+      continue;                         // Not one of ours.
+    TestResult& result = results[child->m_index];
+    finish_child(*child, status, result);
+    running.erase(child);
+    if (on_result)
+      on_result(result);
+  }
+  return results;
+}
+
+int test_main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  int jobs = std::max(1u, std::thread::hardware_concurrency());
+  bool verbose = false;
+  bool list = false;
+  std::vector<std::string> filters;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string const arg = argv[i];
+    if (arg == "-j" && i + 1 < argc)
+      jobs = std::atoi(argv[++i]);
+    else if (arg.compare(0, 2, "-j") == 0 && arg.size() > 2)
+      jobs = std::atoi(arg.c_str() + 2);
+    else if (arg == "-v")
+      verbose = true;
+    else if (arg == "--list")
+      list = true;
+    else if (arg[0] == '-')
+    {
+      std::cerr << "Usage: " << argv[0] << " [-j <jobs>] [-v] [--list] [filter...]" << std::endl;
+      return 2;
+    }
+    else
+      filters.push_back(arg);
+  }
+
+  if (list)
+  {
+    for (TestCase const& test : registered_tests())
+      std::cout << test.m_name << " (" << test.m_file << ':' << test.m_line << ')' << std::endl;
+    return 0;
+  }
+
+  auto const start_time = clock_type::now();
+  std::vector<TestResult> const results = run_tests(filters, jobs, [](TestResult const& result){
+      std::cout << (result.m_passed ? "PASS " : "FAIL ") << std::left << std::setw(32) << result.m_name << std::right <<
+        std::fixed << std::setprecision(2) << std::setw(8) << result.m_seconds << " s" <<
+        std::setw(12) << result.m_permutations << " permutations";
+      if (!result.m_passed)
+        std::cout << "  [" << result.m_status << ']';
+      std::cout << std::endl;
+  });
+  std::chrono::duration<double> const wall_time = clock_type::now() - start_time;
+
+  int number_of_failures = 0;
+  double total_seconds = 0;
+  long total_permutations = 0;
+  for (TestResult const& result : results)
+  {
+    total_seconds += result.m_seconds;
+    total_permutations += result.m_permutations;
+    if (!result.m_passed)
+      ++number_of_failures;
+    if ((verbose || !result.m_passed) && !result.m_output.empty())
+      std::cout << "\n---- Output of " << result.m_name << " ----\n" << result.m_output;
+  }
+  std::cout << '\n' << results.size() << " tests, " << (results.size() - number_of_failures) << " passed, " << number_of_failures << " failed; " <<
+    total_permutations << " permutations in " << std::fixed << std::setprecision(2) << wall_time.count() << " s (" <<
+    total_seconds << " s if run one after another, " << jobs << " jobs)." << std::endl;
+  return number_of_failures == 0 ? 0 : 1;
+}
+
+} // namespace thread_permuter
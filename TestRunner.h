@@ -0,0 +1,85 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <initializer_list>
+
+namespace thread_permuter {
+
+// A scenario that was registered with TP_TEST or TP_TEST_SWEEP.
+struct TestCase
+{
+  std::string m_name;                   // The name of the test; for a sweep followed by the parameter between parentheses.
+  std::function<void()> m_function;     // Runs the scenario (usually by creating a ThreadPermuter and calling run()).
+  char const* m_file;                   // Where the test was defined.
+  int m_line;
+};
+
+// The result of running a TestCase in its own process.
+struct TestResult
+{
+  std::string m_name;
+  bool m_passed;                        // True if the process exited with status 0.
+  std::string m_status;                 // "passed", "exit status <n>" or "signal <n>".
+  double m_seconds;                     // The wall time of the process.
+  long m_permutations;                  // The total number of permutations of all run()s of the test.
+  std::string m_output;                 // Everything that the test wrote to stdout and stderr.
+};
+
+// Adds a test to the registry; used by TP_TEST and TP_TEST_SWEEP.
+class TestRegistration
+{
+ public:
+  TestRegistration(char const* name, char const* file, int line, void (*function)());
+  // Register one test per parameter.
+  TestRegistration(char const* name, char const* file, int line, void (*function)(int), std::initializer_list<int> parameters);
+};
+
+// All registered tests, in the order of registration.
+std::vector<TestCase> const& registered_tests();
+
+// Run the registered tests whose name contains one of filters (all tests if filters is empty), each in its own
+// forked process, with at most jobs processes at the same time. Results are returned in the order of registration.
+// A test fails when its process doesn't exit with status 0, for example because a TP_ASSERT failed.
+// If on_result is set, it is called as soon as a test finished.
+std::vector<TestResult> run_tests(std::vector<std::string> const& filters, int jobs, std::function<void(TestResult const&)> on_result = {});
+
+// The main function of a test runner (see TP_MAIN).
+//
+// Usage: <program> [-j <jobs>] [-v] [--list] [filter...]
+//
+// Runs the tests in parallel (by default as many at a time as there are cores), prints a line
+// for each test when it finished, followed by the output of the tests that failed (of all tests with -v),
+// and a summary. Returns 0 if all tests passed and 1 otherwise.
+int test_main(int argc, char* argv[]);
+
+} // namespace thread_permuter
+
+// Define a scenario:
+//
+// TP_TEST(my_scenario)
+// {
+//   ThreadPermuter tp(...);
+//   tp.run();
+// }
+#define TP_TEST(name) \
+  static void tp_test_##name(); \
+  static thread_permuter::TestRegistration const tp_test_registration_##name(#name, __FILE__, __LINE__, &tp_test_##name); \
+  static void tp_test_##name()
+
+// Define a scenario that is run once for every value of parameter, as separate tests "name(value)":
+//
+// TP_TEST_SWEEP(my_scenario, 0, 1, 2, 3)
+// {
+//   bool started = parameter & 1;
+//   ...
+// }
+#define TP_TEST_SWEEP(name, ...) \
+  static void tp_test_##name(int parameter); \
+  static thread_permuter::TestRegistration const tp_test_registration_##name(#name, __FILE__, __LINE__, &tp_test_##name, { __VA_ARGS__ }); \
+  static void tp_test_##name([[maybe_unused]] int parameter)
+
+// Put this once in a program that only consists of TP_TEST's, instead of main().
+#define TP_MAIN \
+  int main(int argc, char* argv[]) { return thread_permuter::test_main(argc, argv); }
@@ -1,55 +1,199 @@
 #include "sys.h"
 #include "Thread.h"
+#include "Coroutine.h"
 #include "debug.h"
 #include "utils/macros.h"
 #include <mutex>
-
-#ifndef CWDEBUG
-#error "You really want to compile this with libcwd enabled (cmake: -DEnableDebug:BOOL=ON)"
-#endif
+#include <optional>
+#include <algorithm>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
 
 namespace thread_permuter {
 
 Thread::Thread(std::pair<std::function<void()>, ThreadIndex> const& args) :
   m_thi(args.second),
-  m_test(args.first), m_state(yielding),
-  m_last_permutation(false), m_paused(false), m_debug_on(false), m_progress(false),
-  m_thread_name('?')
+  m_test(args.first), m_pool(nullptr), m_worker(nullptr), m_backend(os_thread), m_coroutine_failed(false), m_catch_exceptions(false), m_state(yielding),
+  m_last_permutation(false), m_waits_for(nullptr), m_abandoned(false), m_checkpoint_site(&CheckpointSite::test_entry()),
+  m_paused(false), m_debug_on(false), m_debug_turned_off(false), m_progress(false), m_thread_name('?')
+{
+}
+
+Thread::Thread(std::pair<std::function<std::coroutine_handle<>()>, ThreadIndex> const& args) :
+  m_thi(args.second),
+  m_pool(nullptr), m_worker(nullptr), m_backend(coroutine), m_coroutine_test(args.first), m_coroutine_failed(false), m_catch_exceptions(false), m_state(yielding),
+  m_last_permutation(false), m_waits_for(nullptr), m_abandoned(false), m_checkpoint_site(&CheckpointSite::test_entry()),
+  m_paused(false), m_debug_on(false), m_debug_turned_off(false), m_progress(false), m_thread_name('?')
 {
 }
 
-void Thread::start(char thread_name, bool debug_off)
+void Thread::start(char thread_name, bool debug_off, backend_type backend, bool catch_exceptions, ThreadPool* pool)
 {
   m_thread_name = thread_name;
+  m_pool = pool;
+  m_catch_exceptions = catch_exceptions;
+  m_last_permutation = false;           // This thread might have been stopped before.
+  // Coroutines can only be run as coroutines, and normal functions not.
+  ASSERT((backend == coroutine) == static_cast<bool>(m_coroutine_test));
+  m_backend = backend;
+  if (backend == coroutine)
+    return;                             // The coroutine is created by the first step().
+  if (backend == fiber)
+  {
+    // A fiber shares the debug state of the main thread, so debug_off is not used.
+    m_stack.reset(new FiberStack);
+    getcontext(&m_context);
+    m_context.uc_stack.ss_sp = m_stack->base();
+    m_context.uc_stack.ss_size = m_stack->size();
+    m_context.uc_link = &m_caller_context;      // Return to whoever switched to us when run() returns.
+    uintptr_t const self = reinterpret_cast<uintptr_t>(this);
+    makecontext(&m_context, reinterpret_cast<void(*)()>(&Thread::fiber_entry), 2,
+        static_cast<unsigned int>(self >> 32), static_cast<unsigned int>(self & 0xffffffff));
+    // Run until the fiber is paused.
+    switch_to_fiber();
+    return;
+  }
+  if (backend == futex)
+  {
+    launch(debug_off);
+    m_handoff.wait_until(true);
+    return;
+  }
   std::unique_lock<std::mutex> lock(m_paused_mutex);
   // Start thread.
-  m_thread = std::thread([this, debug_off](){ Thread::run(debug_off); });
+  launch(debug_off);
   // Wait until the thread is paused.
   m_paused_condition.wait(lock, [this]{ return m_paused; });
 }
 
+FiberStack::FiberStack() : m_guard_size(sysconf(_SC_PAGESIZE))
+{
+  // The stack grows down, so the guard page is at the lowest address.
+  void* mapping = mmap(nullptr, m_guard_size + fiber_stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (mapping == MAP_FAILED)
+    DoutFatal(dc::core|error_cf, "mmap of a fiber stack failed");
+  m_mapping = static_cast<char*>(mapping);
+  if (mprotect(m_mapping, m_guard_size, PROT_NONE) != 0)
+    DoutFatal(dc::core|error_cf, "mprotect of the guard page of a fiber stack failed");
+}
+
+FiberStack::~FiberStack()
+{
+  munmap(m_mapping, m_guard_size + fiber_stack_size);
+}
+
+void Thread::launch(bool debug_off)
+{
+  if (m_pool)
+    m_worker = m_pool->start([this, debug_off](){ Thread::run(debug_off); });
+  else
+    m_thread = std::thread([this, debug_off](){ Thread::run(debug_off); });
+}
+
+void Handoff::set_paused(bool paused)
+{
+  uint32_t const previous = m_word.exchange(paused ? paused_bit : 0, std::memory_order_acq_rel);
+  if ((previous & sleeping_bit))
+    syscall(SYS_futex, &m_word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+void Handoff::wait_until(bool paused)
+{
+  uint32_t const wanted = paused ? paused_bit : 0;
+  // Spinning makes no sense when the other side can't run at the same time.
+  static int const spin_count = std::thread::hardware_concurrency() > 1 ? handoff_spin_count : 0;
+  for (int i = 0; i < spin_count; ++i)
+  {
+    if ((m_word.load(std::memory_order_acquire) & paused_bit) == wanted)
+      return;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+  for (;;)
+  {
+    uint32_t word = m_word.load(std::memory_order_acquire);
+    if ((word & paused_bit) == wanted)
+      return;
+    // Tell the other side that it has to wake us up.
+    if (!(word & sleeping_bit) && !m_word.compare_exchange_weak(word, word | sleeping_bit, std::memory_order_acq_rel))
+      continue;
+    syscall(SYS_futex, &m_word, FUTEX_WAIT_PRIVATE, word | sleeping_bit, nullptr, nullptr, 0);
+  }
+}
+
+//static
+void Thread::fiber_entry(unsigned int high, unsigned int low)
+{
+  // makecontext only passes int arguments.
+  Thread* self = reinterpret_cast<Thread*>((static_cast<uintptr_t>(high) << 32) | low);
+  self->run(false);
+}
+
+void Thread::switch_to_fiber()
+{
+  Thread* caller = tl_self;
+  tl_self = this;
+  swapcontext(&m_caller_context, &m_context);
+  tl_self = caller;
+}
+
 void Thread::run(bool debug_off)
 {
-  if (debug_off)
-    Debug(libcw_do.off());
-  Debug(NAMESPACE_DEBUG::init_thread(std::string("thread") + m_thread_name));
+  if (m_backend != fiber)
+  {
+    if (debug_off)
+      Debug(libcw_do.off());
+    m_debug_turned_off = debug_off;
+    if (!m_pool)                        // The threads of a pool were initialized when they were created.
+      Debug(NAMESPACE_DEBUG::init_thread(std::string("thread") + m_thread_name));
+  }
   tl_self = this;                       // Allow a checkpoint to find this object back.
   pause(yielding);                      // Wait until we may enter m_test() for the first time.
   do
   {
+    std::optional<PermutationFailure> failure;
     try
     {
       m_test();                         // Call the test function.
     }
     catch (PermutationFailure const& error)
     {
+      failure = error;
+    }
+    catch (std::exception const& exception)
+    {
+      if (!m_catch_exceptions)
+        throw;
+      failure.emplace(exception, "<test function>");
+    }
+    catch (Abandoned const&)
+    {
+      m_abandoned = false;
+      unlock_held_mutexes();
+    }
+    // fail() pauses, so it may not be called from a catch handler: the exceptions that are
+    // being handled are administered per OS thread, and other fibers run on this one.
+    if (failure)
+    {
 #ifdef CWDEBUG
       libcwd::debug_ct::OnOffState state;
-      Debug(libcw_do.force_on(state));
+      if (m_backend != fiber)           // A fiber would turn on debug output of the main thread.
+        Debug(libcw_do.force_on(state));
+#endif
+      unlock_held_mutexes();            // Let the other threads finish.
+      m_checkpoint_site = &CheckpointSite::test_entry();
+      fail(*failure);
+#ifdef CWDEBUG
+      if (m_backend != fiber)
+        Debug(libcw_do.restore(state));   // This thread continues with the next permutation.
 #endif
-      fail(error);
       continue;
     }
+    m_checkpoint_site = &CheckpointSite::test_entry();  // Not inside m_test() anymore.
     pause(finished);                    // Wait till we may continue with the next permutation.
   }
   while (!m_last_permutation);          // if any.
@@ -59,31 +203,97 @@ void Thread::run(bool debug_off)
 #endif
   Dout(dc::notice|flush_cf, "Leaving Thread::run()");
   Debug(libcw_do.restore(state));
+  // A thread of a pool continues with other test functions.
+  if (m_debug_turned_off)
+    Debug(libcw_do.on());
+  m_debug_turned_off = false;
+  tl_self = nullptr;
 }
 
-void Thread::pause(state_type state)
+// Unlock what wasn't unlocked by destructors, so that the next permutation doesn't find these locked.
+void Thread::unlock_held_mutexes()
+{
+  while (!m_held_mutexes.empty())
+    static_cast<Mutex*>(const_cast<void*>(m_held_mutexes.back()))->unlock();
+}
+
+void Thread::set_state(state_type state)
 {
   if (m_progress && state == blocking)
     state = blocking_with_progress;
   m_progress = false;
+  m_state = state;
+}
 
+void Thread::pause(state_type state)
+{
   Dout(dc::permutation|flush_cf, "Thread::pause(" << state << ")");
-  m_state = state;
-  std::unique_lock<std::mutex> lock(m_paused_mutex);
-  m_paused = true;
-  m_paused_condition.notify_one();
-  m_paused_condition.wait(lock, [this]{ return !m_paused; });
+  set_state(state);
+  if (m_backend == fiber)
+  {
+    // Return to step() (or start()). Debug output of a fiber is that of the main thread.
+    swapcontext(&m_context, &m_caller_context);
+    if (m_abandoned && std::uncaught_exceptions() == 0)
+      throw Abandoned();
+    return;
+  }
+  if (m_backend == futex)
+  {
+    m_handoff.set_paused(true);
+    m_handoff.wait_until(false);
+  }
+  else
+  {
+    std::unique_lock<std::mutex> lock(m_paused_mutex);
+    m_paused = true;
+    m_paused_condition.notify_one();
+    m_paused_condition.wait(lock, [this]{ return !m_paused; });
+  }
   if (m_debug_on)
   {
     Debug(libcw_do.on());
     m_debug_on = false;
+    m_debug_turned_off = false;
   }
+  // Don't throw while a destructor is already unwinding the test function.
+  if (m_abandoned && std::uncaught_exceptions() == 0)
+    throw Abandoned();
+}
+
+void Thread::begin_step()
+{
+  m_footprint.clear();                  // Start recording the accesses of this step.
+  for (void const* mutex : m_held_mutexes)
+    m_footprint.add(mutex, false);      // Holding a mutex during the whole step counts as reading it.
 }
 
 state_type Thread::step(bool& debug_on)
 {
+  if (m_backend == futex)
+  {
+    begin_step();
+    if (debug_on)
+    {
+      m_debug_on = true;
+      debug_on = false;
+    }
+    m_handoff.set_paused(false);
+    m_handoff.wait_until(true);
+    return m_state;
+  }
+  if (m_backend != os_thread)
+  {
+    begin_step();
+    debug_on = false;                   // The main thread already turned debug output on.
+    if (m_backend == fiber)
+      switch_to_fiber();
+    else
+      resume_coroutine();
+    return m_state;
+  }
   std::unique_lock<std::mutex> lock(m_paused_mutex);
   m_paused = false;
+  begin_step();
   if (debug_on)
   {
     m_debug_on = true;
@@ -99,17 +309,163 @@ state_type Thread::step(bool& debug_on)
 void Thread::stop()
 {
   m_last_permutation = true;
+  if (m_backend == coroutine)
+  {
+    if (m_task)
+      m_task.destroy();
+    m_task = nullptr;
+    return;
+  }
+  if (m_backend == fiber)
+  {
+    // Let run() return.
+    switch_to_fiber();
+    m_stack.reset();
+    return;
+  }
+  if (m_backend == futex)
+    m_handoff.set_paused(false);        // Wake up the thread and let it exit.
+  else
   {
     std::unique_lock<std::mutex> lock(m_paused_mutex);
     m_paused = false;
     // Wake up the thread and let it exit.
     m_paused_condition.notify_one();
   }
+  if (m_worker)
+  {
+    // Wait until run() returned; the thread itself is reused.
+    Dout(dc::notice|flush_cf, "Waiting for pool thread " << m_worker->m_index);
+    m_pool->wait(m_worker);
+    m_worker = nullptr;
+    return;
+  }
   // Join with it.
   Dout(dc::notice|flush_cf, "Joining with thread " << std::hex << m_thread.get_id());
   m_thread.join();
 }
 
+void Thread::abandon()
+{
+  DoutEntering(dc::permutation, "Thread::abandon() [thread " << m_thi << "]");
+  m_waits_for = nullptr;
+  if (m_backend == coroutine)
+  {
+    Thread* caller = tl_self;
+    tl_self = this;                     // Destroying the coroutine frames may unlock mutexes.
+    if (m_task)
+      m_task.destroy();
+    while (!m_held_mutexes.empty())
+      static_cast<CoroutineMutex*>(const_cast<void*>(m_held_mutexes.back()))->unlock();
+    tl_self = caller;
+    m_task = nullptr;
+    m_resume_condition = nullptr;
+    m_coroutine_failed = false;
+    m_checkpoint_site = &CheckpointSite::test_entry();
+    m_state = finished;
+    return;
+  }
+  // Let pause() throw, which unwinds the test function to run().
+  m_abandoned = true;
+  bool debug_on = false;
+  state_type state;
+  do
+    state = step(debug_on);             // A destructor might still run into a checkpoint.
+  while (state != finished && state != failed);
+}
+
+void Thread::resume_coroutine()
+{
+  Thread* caller = tl_self;
+  tl_self = this;
+  if (!m_task)
+  {
+    // Start the next run of the test.
+    m_task = m_coroutine_test();
+    m_resume = m_task;
+  }
+  if (m_resume_condition && !m_resume_condition())
+  {
+    Dout(dc::permutation, "Thread::resume_coroutine: still blocked.");
+    set_state(blocking);
+  }
+  else
+  {
+    m_resume_condition = nullptr;
+    m_resume.resume();
+    if (m_task.done())
+    {
+      m_task.destroy();
+      m_task = nullptr;
+      m_checkpoint_site = &CheckpointSite::test_entry();        // Not inside the test anymore.
+      m_state = m_coroutine_failed ? failed : finished;
+      m_coroutine_failed = false;
+    }
+  }
+  tl_self = caller;
+}
+
+//static
+void Thread::suspend(std::coroutine_handle<> handle, state_type state, std::function<bool()> resume_condition)
+{
+  Dout(dc::permutation, "Thread::suspend(" << state << ")");
+  tl_self->set_state(state);
+  tl_self->m_resume = handle;
+  tl_self->m_resume_condition = std::move(resume_condition);
+}
+
+//static
+void Thread::coroutine_failed(std::exception_ptr exception)
+{
+  try
+  {
+    std::rethrow_exception(exception);
+  }
+  catch (PermutationFailure const& error)
+  {
+    tl_self->set_failure(error);
+    tl_self->m_coroutine_failed = true;
+  }
+  catch (std::exception const& exception)
+  {
+    if (!tl_self->m_catch_exceptions)
+      throw;
+    tl_self->set_failure(PermutationFailure(exception, "<test function>"));
+    tl_self->m_coroutine_failed = true;
+  }
+}
+
+void Thread::set_failure(PermutationFailure const& error)
+{
+  // The message of error may have been allocated by the test function, from the arena, while
+  // m_failure is still used after the next permutation started. Copy the string itself.
+  Arena::Unrouted unrouted;
+  m_failure = PermutationFailure(error.what(), error.file(), error.line());
+}
+
+//static
+void Thread::acquired(void const* mutex)
+{
+  if (!tl_self)
+    return;
+  Arena::Unrouted unrouted;
+  tl_self->m_footprint.add(mutex, true);
+  tl_self->m_held_mutexes.push_back(mutex);
+  tl_self->m_waits_for = nullptr;
+}
+
+//static
+void Thread::released(void const* mutex)
+{
+  if (!tl_self)
+    return;
+  Arena::Unrouted unrouted;
+  tl_self->m_footprint.add(mutex, true);
+  auto iter = std::find(tl_self->m_held_mutexes.begin(), tl_self->m_held_mutexes.end(), mutex);
+  if (iter != tl_self->m_held_mutexes.end())
+    tl_self->m_held_mutexes.erase(iter);
+}
+
 //static
 thread_local Thread* Thread::tl_self;
 
@@ -1,11 +1,23 @@
 #pragma once
 
 #include "debug.h"
+#include "Footprint.h"
+#include "WideBitSet.h"
+#include "CheckpointSite.h"
+#include "Arena.h"
+#include "ThreadPool.h"
 #include "utils/Vector.h"
 #include "utils/BitSet.h"
 #include <functional>
 #include <thread>
 #include <condition_variable>
+#include <memory>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <cstring>
+#include <iostream>
+#include <ucontext.h>
 
 #if defined(CWDEBUG) && !defined(DOXYGEN)
 NAMESPACE_DEBUG_CHANNELS_START
@@ -30,17 +42,50 @@ class ThreadIndex : public utils::VectorIndex<vector_index_category::thread_inde
  public:
   // Allow bitset::Index to be used where ThreadIndex is required.
   ThreadIndex(utils::bitset::Index index) : utils::VectorIndex<vector_index_category::thread_index>(index()) { }
+  ThreadIndex(thread_permuter::WideIndex index) : utils::VectorIndex<vector_index_category::thread_index>(index()) { }
 };
 
+// The maximum number of test functions, set with the cmake variable of the same name.
+#ifndef THREADPERMUTER_MAX_THREADS
+#define THREADPERMUTER_MAX_THREADS 32
+#endif
+
 namespace thread_permuter {
 
+constexpr int max_threads = THREADPERMUTER_MAX_THREADS;
+// A Schedule stores a thread index in a byte.
+static_assert(0 < max_threads && max_threads <= 256, "THREADPERMUTER_MAX_THREADS must be in the range [1, 256].");
+
+// Up to 64 threads a set of threads is a single integer; beyond that a WideBitSet.
+#if THREADPERMUTER_MAX_THREADS <= 32
 using mask_type = uint32_t;
 using threads_set_type = utils::BitSet<mask_type>;
+#elif THREADPERMUTER_MAX_THREADS <= 64
+using mask_type = uint64_t;
+using threads_set_type = utils::BitSet<mask_type>;
+#else
+using threads_set_type = WideBitSet<(THREADPERMUTER_MAX_THREADS + 63) / 64>;
+#endif
 
 // Allow conversion from ThreadIndex to threads_set_type.
 inline threads_set_type index2mask(ThreadIndex thi)
 {
+#if THREADPERMUTER_MAX_THREADS <= 64
   return threads_set_type(mask_type{1} << thi.get_value());
+#else
+  return threads_set_type::single(thi.get_value());
+#endif
+}
+
+// Return the set of all threads with an index less than thi.
+inline threads_set_type indices_below(ThreadIndex thi)
+{
+#if THREADPERMUTER_MAX_THREADS <= 64
+  constexpr int bits = 8 * sizeof(mask_type);
+  return threads_set_type(thi.get_value() >= bits ? ~mask_type{0} : (mask_type{1} << thi.get_value()) - 1);
+#else
+  return threads_set_type::below(thi.get_value());
+#endif
 }
 
 } // namespace thread_permuter
@@ -53,6 +98,18 @@ class PermutationFailure final : public std::runtime_error
  public:
   PermutationFailure() : std::runtime_error("<no error>"), m_file("<no file>"), m_line(-1) { }
   PermutationFailure(char const* msg, char const* file, int line) : std::runtime_error(msg), m_file(file), m_line(line) { }
+  // An exception that escaped from where (for example, "<test function>").
+  PermutationFailure(std::exception const& exception, char const* where) :
+    std::runtime_error(std::string("uncaught exception: ") + exception.what()), m_file(where), m_line(0) { }
+
+  char const* file() const { return m_file; }
+  int line() const { return m_line; }
+
+  // Return true if this failure happened at the same TP_ASSERT as other (or is the same uncaught exception).
+  bool same_site(PermutationFailure const& other) const
+  {
+    return m_line == other.m_line && std::strcmp(m_file, other.m_file) == 0 && std::strcmp(what(), other.what()) == 0;
+  }
 
   std::string message() const
   {
@@ -66,6 +123,14 @@ class PermutationFailure final : public std::runtime_error
   }
 };
 
+// Print a failure (or anything else that the user must see even when all debug output is off).
+// Without libcwd there is no debug output at all, so then it is written to std::cerr.
+#ifdef CWDEBUG
+#define TP_REPORT_FAILURE(data) Dout(dc::notice, data)
+#else
+#define TP_REPORT_FAILURE(data) do { std::cerr << data << std::endl; } while (0)
+#endif
+
 namespace thread_permuter {
 
 enum state_type
@@ -91,37 +156,124 @@ inline std::ostream& operator<<(std::ostream& os, state_type state)
 
 class ConditionVariable;
 
+// How the test functions are run.
+enum backend_type
+{
+  os_thread,                    // Every test function runs in its own std::thread; each step costs two condition variable handoffs.
+  fiber,                        // Every test function runs on its own stack in the main thread; each step is a direct stack switch.
+  coroutine,                    // Every test function is a coroutine (see Coroutine.h) that is resumed by the main thread.
+  futex                         // Like os_thread, but the handoff spins on an atomic for a while before waiting on a futex.
+};
+
+// The size of the stack of a fiber.
+constexpr size_t fiber_stack_size = 256 * 1024;
+
+// The stack of a fiber, mapped with an inaccessible guard page below it: a test function
+// that overflows its stack then crashes instead of overwriting other memory.
+class FiberStack
+{
+  char* m_mapping;                      // The guard page, followed by the stack.
+  size_t m_guard_size;                  // The size of the guard page.
+
+ public:
+  FiberStack();
+  ~FiberStack();
+  FiberStack(FiberStack const&) = delete;
+  FiberStack& operator=(FiberStack const&) = delete;
+
+  void* base() const { return m_mapping + m_guard_size; }
+  size_t size() const { return fiber_stack_size; }
+};
+
+// The number of times that the futex backend checks the atomic before going to sleep (unless there is only one CPU).
+constexpr int handoff_spin_count = 4000;
+
+constexpr size_t cache_line_size = 64;
+
+// The word that the controlling thread and a test thread hand control to each other with (futex backend).
+//
+// Bit 0 is set while the test thread is paused; bit 1 is set while one of both is sleeping in futex_wait.
+// It is put on a cache line of its own, so that spinning on it doesn't interfere with the other threads.
+class alignas(cache_line_size) Handoff
+{
+ private:
+  std::atomic<uint32_t> m_word;
+  char m_padding[cache_line_size - sizeof(std::atomic<uint32_t>)];
+
+  static constexpr uint32_t paused_bit = 1;
+  static constexpr uint32_t sleeping_bit = 2;
+
+ public:
+  Handoff() : m_word(0) { }
+
+  void set_paused(bool paused);         // Set or reset bit 0, and wake up the other side if it is sleeping.
+  void wait_until(bool paused);         // Wait until bit 0 becomes paused.
+};
+
 class Thread
 {
  public:
   Thread(std::pair<std::function<void()>, ThreadIndex> const& args);
+  // The function returns the handle of a new coroutine, that is then owned by this Thread.
+  Thread(std::pair<std::function<std::coroutine_handle<>()>, ThreadIndex> const& args);
   ThreadIndex get_thi() const { return m_thi; }
 
-  void start(char thread_name, bool debug_off); // Start the thread and prepare calling step().
-  void run(bool debug_off);             // Entry point of m_thread.
+  // Start the thread and prepare calling step().
+  // If catch_exceptions is true, any std::exception that escapes the test function is turned into a PermutationFailure.
+  // If pool is not null, the os_thread and futex backends use one of its threads instead of creating one.
+  void start(char thread_name, bool debug_off, backend_type backend = os_thread, bool catch_exceptions = false, ThreadPool* pool = nullptr);
+  void run(bool debug_off);             // Entry point of m_thread (or of the fiber).
   state_type step(bool& debug_on);      // Wake up the thread and let it run till the next check point (or finish).
                                         // Returns true when m_test() returned.
   void pause(state_type state);         // Pause the thread and wake up the main thread again.
   void stop();                          // Called when all permutation have been run.
+  void abandon();                       // Unwind the test function of a dead locked thread, so that it can start the next permutation.
   void made_progress() { m_progress = true; }
   ConditionVariable* condition_variable() const { return m_condition_variable; }
+  Footprint const& footprint() const { return m_footprint; }
+  CheckpointSite const& checkpoint_site() const { return *m_checkpoint_site; }
 
   char get_name() const { return m_thread_name; }
   PermutationFailure failure() const { return m_failure; }
+  state_type state() const { return m_state; }
+  void const* waits_for() const { return m_waits_for; }
+  std::vector<void const*> const& held_mutexes() const { return m_held_mutexes; }
+
+  // Thrown by pause() in a thread that is abandoned. Not derived from std::exception, so that test functions don't catch it.
+  struct Abandoned { };
 
  private:
   ThreadIndex m_thi;                    // The index of this thread.
   std::function<void()> m_test;         // Thread entry point. The first time step() is called
                                         // after start(), this function will be called.
-  std::thread m_thread;                 // The actual thread.
+  std::thread m_thread;                 // The actual thread (when m_backend is os_thread or futex, and there is no pool).
+  ThreadPool* m_pool;                   // The pool that was passed to start(), if any.
+  ThreadPool::Worker* m_worker;         // The thread of m_pool that runs this test function.
+  backend_type m_backend;               // The backend that was passed to start().
+  ucontext_t m_context;                 // The context of the fiber (when m_backend is fiber).
+  ucontext_t m_caller_context;          // The context that switched to the fiber.
+  std::unique_ptr<FiberStack> m_stack;  // The stack of the fiber.
+  std::function<std::coroutine_handle<>()> m_coroutine_test; // Creates the coroutine (when m_backend is coroutine).
+  std::coroutine_handle<> m_task;       // The running top-level coroutine, if any.
+  std::coroutine_handle<> m_resume;     // The (possibly nested) coroutine that must be resumed by the next step.
+  std::function<bool()> m_resume_condition; // If set, the coroutine is only resumed once this returns true.
+  bool m_coroutine_failed;              // Set when the top-level coroutine exited with a PermutationFailure.
+  bool m_catch_exceptions;              // Set when other exceptions of the test function must be turned into a PermutationFailure too.
   state_type m_state;
   bool m_last_permutation;              // True after all permutation have been run.
   ConditionVariable* m_condition_variable; // Valid when pause is called with waiting, notify_one or notify_all.
+  Footprint m_footprint;                // The accesses annotated during the last step (see TPY_READ and TPY_WRITE).
+  std::vector<void const*> m_held_mutexes; // The Mutex objects that are currently locked by this thread.
+  void const* m_waits_for;              // The Mutex that this thread is blocked on, if any.
+  bool m_abandoned;                     // Set by abandon(); causes pause() to throw Abandoned.
+  CheckpointSite const* m_checkpoint_site; // The checkpoint that this thread is paused at.
 
+  Handoff m_handoff;                    // Used instead of m_paused_condition when m_backend is futex.
   std::condition_variable m_paused_condition;
   std::mutex m_paused_mutex;
   bool m_paused;                        // True when the thread is waiting.
   bool m_debug_on;                      // Set to true when debug output must be turned on in this thread.
+  bool m_debug_turned_off;              // Set while run() has debug output of its thread turned off.
   bool m_progress;                      // Set to true when TPP is used; causes the next TPB to call pause(blocking_with_progress);
   PermutationFailure m_failure;         // Error of last exception thrown.
 
@@ -129,6 +281,15 @@ class Thread
 
   static thread_local Thread* tl_self;  // A thread_local pointer to self.
 
+  void begin_step();                    // Prepare the recording of the next step.
+  void launch(bool debug_off);          // Start a thread (or use one of m_pool) that calls run().
+  void switch_to_fiber();               // Run the fiber until it pauses (or returns from run()).
+  static void fiber_entry(unsigned int high, unsigned int low);
+  void resume_coroutine();              // Run the coroutine until it suspends (or finishes).
+  void set_state(state_type state);     // Record the state that the current step ended with.
+  void unlock_held_mutexes();           // Unlock the Mutex objects that the test function left locked when it was unwound.
+  void set_failure(PermutationFailure const& error);    // Store a copy of error that doesn't use the arena.
+
  public:
   static void yield() { tl_self->pause(yielding); }
   static void blocked() { tl_self->pause(blocking); }
@@ -137,12 +298,30 @@ class Thread
   static void notify_one(ConditionVariable* condition_variable) { tl_self->m_condition_variable = condition_variable; tl_self->pause(thread_permuter::notify_one); }
   static void notify_all(ConditionVariable* condition_variable) { tl_self->m_condition_variable = condition_variable; tl_self->pause(thread_permuter::notify_all); }
   static void progress() { tl_self->made_progress(); }
-  static void fail(PermutationFailure const& error) { tl_self->m_failure = error; tl_self->pause(failed); }
+  // The Footprint of a thread is reused by the next permutations, so it must not grow into the arena.
+  static void read(void const* object) { Arena::Unrouted unrouted; tl_self->m_footprint.add(object, false); }
+  static void write(void const* object) { Arena::Unrouted unrouted; tl_self->m_footprint.add(object, true); }
+  static void local() { tl_self->m_footprint.mark_local(); }
+  static void checkpoint(CheckpointSite const& site) { tl_self->m_checkpoint_site = &site; }
+  // Called by Mutex and ConditionVariable. These may also be used outside of the test threads, hence the test of tl_self.
+  static void touch(void const* primitive, bool write) { Arena::Unrouted unrouted; if (tl_self) tl_self->m_footprint.add(primitive, write); }
+  static void blocked_on(void const* mutex) { tl_self->m_waits_for = mutex; }
+  static void acquired(void const* mutex);
+  static void released(void const* mutex);
+  static void fail(PermutationFailure const& error) { tl_self->set_failure(error); tl_self->pause(failed); }
+  // Called by the awaitables of Coroutine.h: handle must be resumed by the next step of this thread.
+  static void suspend(std::coroutine_handle<> handle, state_type state, std::function<bool()> resume_condition = {});
+  // Called when the top-level coroutine exits with an exception.
+  static void coroutine_failed(std::exception_ptr exception);
   static char name() { return tl_self->get_name(); }
   static Thread* current() { return tl_self; }
 };
 
 // Use this instead of std::mutex.
+//
+// A Mutex records itself in the Footprint of the current step: locking and unlocking it counts
+// as a write, a failed attempt to lock it and holding it during a step count as a read.
+// Shared data that is accessed while holding a Mutex is assumed to be protected by it.
 class Mutex
 {
  private:
@@ -155,8 +334,12 @@ class Mutex
     while (!m_mutex.try_lock())
     {
       Dout(dc::permutation, "Blocked on mutex [" << (void*)this << "]");
+      Thread::touch(this, false);
+      Thread::checkpoint(TP_CHECKPOINT_SITE("Mutex::lock"));
+      Thread::blocked_on(this);
       Thread::blocked();
     }
+    Thread::acquired(this);
     Dout(dc::finish, "successfully locked [" << (void*)this << "]");
   }
 
@@ -164,6 +347,10 @@ class Mutex
   {
     DoutEntering(dc::permutation|continued_cf, "Mutex::try_lock() [" << (void*)this << "]... ");
     bool locked = m_mutex.try_lock();
+    if (locked)
+      Thread::acquired(this);
+    else
+      Thread::touch(this, false);
     Dout(dc::finish, (locked ? "locked" : "failed"));
     return locked;
   }
@@ -171,6 +358,7 @@ class Mutex
   void unlock()
   {
     DoutEntering(dc::permutation, "Mutex::unlock() [" << (void*)this << "]");
+    Thread::released(this);
     m_mutex.unlock();
   }
 
@@ -183,8 +371,18 @@ class Mutex
 } // namespace thread_permuter
 
 // Use this to make the thread yield and either continue with a different thread or with the same thread again.
-#define TPY do { Dout(dc::permutation, "TPY at " << __FILE__ << ":" << __LINE__); thread_permuter::Thread::yield(); } while(0)
+#define TPY do { Dout(dc::permutation, "TPY at " << __FILE__ << ":" << __LINE__); thread_permuter::Thread::checkpoint(TP_CHECKPOINT_SITE("TPY")); thread_permuter::Thread::yield(); } while(0)
 // Use this to make the thread yield and force the run of another thread before running this thread again.
-#define TPB do { Dout(dc::permutation, "TPB at " << __FILE__ << ":" << __LINE__); thread_permuter::Thread::blocked(); } while(0)
+#define TPB do { Dout(dc::permutation, "TPB at " << __FILE__ << ":" << __LINE__); thread_permuter::Thread::checkpoint(TP_CHECKPOINT_SITE("TPB")); thread_permuter::Thread::blocked(); } while(0)
 // Use this just before a TPB if the thread made any progress, so that it is ok to run other, previously blocking threads.
 #define TPP do { Dout(dc::permutation, "TPP at " << __FILE__ << ":" << __LINE__); thread_permuter::Thread::progress(); } while(0)
+// Like TPY, but also tell the permuter that the step that ends here read (respectively wrote) the object at ptr.
+// If one step is annotated then all shared accesses of that step must be annotated (use TP_READ and TP_WRITE for the others).
+// These annotations are only used by the DPOR exploration mode (see ThreadPermuter::set_dpor).
+#define TPY_READ(ptr) do { Dout(dc::permutation, "TPY_READ(" << (void const*)(ptr) << ") at " << __FILE__ << ":" << __LINE__); thread_permuter::Thread::read(ptr); thread_permuter::Thread::checkpoint(TP_CHECKPOINT_SITE("TPY_READ")); thread_permuter::Thread::yield(); } while(0)
+#define TPY_WRITE(ptr) do { Dout(dc::permutation, "TPY_WRITE(" << (void const*)(ptr) << ") at " << __FILE__ << ":" << __LINE__); thread_permuter::Thread::write(ptr); thread_permuter::Thread::checkpoint(TP_CHECKPOINT_SITE("TPY_WRITE")); thread_permuter::Thread::yield(); } while(0)
+// Annotate an access of the current step without yielding.
+#define TP_READ(ptr) thread_permuter::Thread::read(ptr)
+#define TP_WRITE(ptr) thread_permuter::Thread::write(ptr)
+// Annotate that the current step accesses no shared objects other than those passed to TP_READ or TP_WRITE (for example, the last step of a test function).
+#define TP_LOCAL thread_permuter::Thread::local()
@@ -1,14 +1,32 @@
 #include "sys.h"
 #include "ThreadPermuter.h"
 #include "Permutation.h"
+#include "Connection.h"
+#include "Coroutine.h"
+#include "Snapshots.h"
+#include "PctScheduler.h"
+#include "SearchStateFile.h"
+#include "Minimizer.h"
+#include "TreeEstimate.h"
+#include <random>
+#include <fstream>
+#include <cstdlib>
 #include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <memory>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
 
 using namespace thread_permuter;
 
 ThreadPermuter::ThreadPermuter(
     std::function<void()> on_permutation_begin,
     tests_type const& tests,
-    std::function<void(std::string const&)> on_permutation_end)
+    on_permutation_end_type on_permutation_end)
   : m_on_permutation_begin(on_permutation_begin), m_on_permutation_end(on_permutation_end)
 {
   std::vector<std::pair<std::function<void()>, thi_type>> vp;
@@ -16,72 +34,845 @@ ThreadPermuter::ThreadPermuter(
     vp.emplace_back(tests[thi], thi);
   utils::Vector<thread_permuter::Thread, thi_type> tmp(vp.begin(), vp.end());
   m_threads = std::move(tmp);
+  // Configure cmake with a larger THREADPERMUTER_MAX_THREADS to run more test functions.
+  ASSERT(m_threads.size() <= static_cast<size_t>(max_threads));
+  m_schedule = Schedule(m_threads.size());
+}
+
+ThreadPermuter::ThreadPermuter(
+    std::function<void()> on_permutation_begin,
+    coroutine_tests_type const& tests,
+    on_permutation_end_type on_permutation_end)
+  : m_on_permutation_begin(on_permutation_begin), m_on_permutation_end(on_permutation_end), m_backend(thread_permuter::coroutine)
+{
+  std::vector<std::pair<std::function<std::coroutine_handle<>()>, thi_type>> vp;
+  for (thi_type thi = tests.ibegin(); thi != tests.iend(); ++thi)
+    vp.emplace_back([test = tests[thi]]{ return test().release(); }, thi);
+  utils::Vector<thread_permuter::Thread, thi_type> tmp(vp.begin(), vp.end());
+  m_threads = std::move(tmp);
+  // Configure cmake with a larger THREADPERMUTER_MAX_THREADS to run more test functions.
+  ASSERT(m_threads.size() <= static_cast<size_t>(max_threads));
+  m_schedule = Schedule(m_threads.size());
 }
 
 ThreadPermuter::~ThreadPermuter()
 {
 }
 
+//static
+ThreadPermuter::on_permutation_end_type ThreadPermuter::string_callback(on_permutation_end_string_type on_permutation_end)
+{
+  // Reuse the capacity of the same string for every permutation.
+  return [on_permutation_end = std::move(on_permutation_end), permutation_string = std::string()](ScheduleView schedule) mutable {
+    schedule.copy_to(permutation_string);
+    on_permutation_end(permutation_string);
+  };
+}
+
+void ThreadPermuter::configure(Permutation& permutation) const
+{
+  // DPOR and sleep sets rely on the subtrees that a state hash prunes being explored.
+  ASSERT(!m_state_hash || (!m_dpor && !m_sleep_sets));
+  if (m_state_hash && (m_dpor || m_sleep_sets))
+    DoutFatal(dc::core, "set_state_hash can't be combined with set_dpor or set_sleep_sets.");
+  // Symmetry reduction prunes swaps of identical threads, which DPOR and sleep sets don't take into account.
+  ASSERT(m_symmetry_classes.empty() || (!m_dpor && !m_sleep_sets));
+  if (!m_symmetry_classes.empty() && (m_dpor || m_sleep_sets))
+    DoutFatal(dc::core, "set_symmetry_classes can't be combined with set_dpor or set_sleep_sets.");
+  permutation.set_dpor(m_dpor);
+  permutation.set_sleep_sets(m_sleep_sets);
+  if (m_state_hash)
+    permutation.set_state_hash(m_state_hash);
+  if (!m_symmetry_classes.empty())
+    permutation.set_symmetry_classes(m_symmetry_classes);
+}
+
+void ThreadPermuter::start_threads(bool debug_off)
+{
+  if (m_arena_operator_new)
+    Arena::route_operator_new(&m_arena);
+  thi_type const end(m_threads.size());
+  for (thi_type thi(0); thi < end; ++thi)
+    m_threads[thi].start(thi_to_char(thi), debug_off, m_backend, m_keep_exploring, m_thread_pool);
+}
+
+void ThreadPermuter::stop_threads()
+{
+  thi_type const end(m_threads.size());
+  for (thi_type thi(0); thi < end; ++thi)
+    m_threads[thi].stop();
+  if (m_arena_operator_new)
+    Arena::route_operator_new(nullptr);
+}
+
+void ThreadPermuter::begin_permutation()
+{
+  // Whatever was allocated from the arena during the previous permutation is no longer in use.
+  m_arena.reset();
+  m_on_permutation_begin();
+}
+
 void ThreadPermuter::run(std::string single_permutation, bool continue_running, bool debug_on)
 {
+  auto const start_time = std::chrono::steady_clock::now();
   Permutation permutation(m_threads);
+  configure(permutation);
+  if (m_checkpoint_report)
+    CheckpointSite::reset_statistics();
+  m_failures.clear();
 
   bool debug_off = !debug_on && (single_permutation.empty() || continue_running);
 
   // Start all threads.
-  thi_type const end(m_threads.size());
-  for (thi_type thi(0); thi < end; ++thi)
-    m_threads[thi].start('0' + thi.get_value(), debug_off);
+  start_threads(debug_off);
 
   if (!single_permutation.empty())
     permutation.program(single_permutation);
 
-  if (single_permutation.empty() || continue_running)
+  // Estimate the size of the exhaustive search, if a time budget or progress reports were requested.
+  int const limit = m_limit;
+  std::unique_ptr<TreeEstimate> tree_estimate;
+  if (single_permutation.empty() && m_snapshot_budget == 0 && m_max_preemptions < 0 &&
+      (m_time_budget.count() > 0 || m_progress_interval.count() > 0))
   {
+    tree_estimate = std::make_unique<TreeEstimate>((static_cast<uint64_t>(std::random_device{}()) << 32) | std::random_device{}());
     Debug(libcw_do.off());
-    int number_of_permutations = 0;
-    for (;;)
+    probe(*tree_estimate, std::max(m_time_budget.count() > 0 ? m_budget_probes : 0, m_progress_interval.count() > 0 ? m_progress_probes : 0));
+    Debug(libcw_do.on());
+    if (m_time_budget.count() > 0)
+    {
+      m_limit = std::min(m_limit, tree_estimate->largest_limit(m_time_budget.count()));
+      std::cout << "Time budget of " << m_time_budget.count() << " s: ";
+      if (m_limit == std::numeric_limits<int>::max())
+        std::cout << "no limit";
+      else
+        std::cout << "limit " << m_limit;
+      std::cout << " (about " << static_cast<long>(tree_estimate->permutations(m_limit)) << " permutations of " <<
+        tree_estimate->seconds_per_permutation() * 1e6 << " microseconds)." << std::endl;
+    }
+    if (m_progress_interval.count() > 0)
+    {
+      m_tree_estimate = tree_estimate.get();
+      m_explore_start = m_last_progress = std::chrono::steady_clock::now();
+    }
+  }
+
+  if ((single_permutation.empty() || continue_running) && m_snapshot_budget > 0)
+  {
+    // Only a single OS thread can be forked: the os_thread and futex backends (and a thread pool) run the tests in threads of their own.
+    ASSERT(m_backend == fiber || m_backend == coroutine);
+    // Snapshots explore exhaustively; a preemption bound would be ignored.
+    ASSERT(m_max_preemptions < 0);
+    Snapshots snapshots(m_snapshot_budget);
+    m_snapshots = &snapshots;
+    permutation.set_snapshot_hook([&](int depth){
+        return depth > 0 && depth < m_limit && snapshots.take(permutation, depth, m_schedule.str());
+    });
+    snapshots.run([&]{ explore(permutation, nullptr); });
+    m_snapshots = nullptr;
+    m_number_of_permutations = snapshots.number_of_permutations();
+    Dout(dc::notice(snapshots.number_of_redundant_permutations() > 0), snapshots.number_of_redundant_permutations() << " permutations were only run to finish the threads (all threads were asleep).");
+    Dout(dc::notice|flush_cf, "All " << m_number_of_permutations << " permutations finished; " << snapshots.failures().size() << " failed.");
+  }
+  else if ((single_permutation.empty() || continue_running) && m_max_preemptions >= 0)
+  {
+    // The bound only works if every permutation within it is explored.
+    ASSERT(!m_dpor && !m_sleep_sets && !m_state_hash);
+    int total = 0;
+    long total_steps = 0;
+    for (int bound = 0; bound <= m_max_preemptions; ++bound)
+    {
+      permutation.program(single_permutation);
+      permutation.set_preemption_bound(bound);
+      explore(permutation, nullptr);
+      total += m_number_of_permutations;
+      total_steps += m_number_of_steps;
+      Dout(dc::notice|flush_cf, "All permutations with at most " << bound << " preemptions finished (" << m_number_of_permutations << " new).");
+      if (!permutation.bound_exceeded())
+        break;
+    }
+    m_number_of_permutations = total;
+    m_number_of_steps = total_steps;
+    Dout(dc::notice|flush_cf, "Completed " << m_number_of_permutations << " number of permutations.");
+  }
+  else if (single_permutation.empty() && !m_search_state_path.empty())
+  {
+    // The saved state only covers the search tree of a single explore(), and the footprints
+    // of sleep sets hold addresses that are meaningless in the process that resumes.
+    ASSERT(!m_state_hash && !m_sleep_sets);
+    SearchStateFile search_state_file(m_search_state_path, m_search_state_interval,
+        { static_cast<int>(m_threads.size()), m_limit, m_dpor, m_sleep_sets, !m_symmetry_classes.empty() });
+    search_state_file.load(permutation);
+    m_search_state_file = &search_state_file;
+    explore(permutation, nullptr);
+    m_search_state_file = nullptr;
+    search_state_file.remove();
+    m_number_of_permutations += search_state_file.previous_permutations();
+    m_number_of_redundant_permutations += search_state_file.previous_redundant_permutations();
+    Dout(dc::notice(m_number_of_redundant_permutations > 0), m_number_of_redundant_permutations << " permutations were only run to finish the threads (all threads were asleep).");
+    Dout(dc::notice|flush_cf, "All " << m_number_of_permutations << " permutations finished.");
+  }
+  else if (single_permutation.empty() || continue_running)
+  {
+    explore(permutation, nullptr);
+    Dout(dc::notice(permutation.visited_states().number_of_pruned() > 0), "Pruned " << permutation.visited_states().number_of_pruned() <<
+        " times because a state was visited before (" << permutation.visited_states().size() << " different states).");
+    Dout(dc::notice(m_number_of_redundant_permutations > 0), m_number_of_redundant_permutations << " permutations were only run to finish the threads (all threads were asleep).");
+    if (m_limit == std::numeric_limits<int>::max())
+      Dout(dc::notice|flush_cf, "All " << m_number_of_permutations << " permutations finished.");
+    else
+      Dout(dc::notice|flush_cf, "Completed " << m_number_of_permutations << " number of permutations.");
+  }
+  else
+  {
+    begin_permutation();
+    m_schedule.clear();
+    try
+    {
+      permutation.play(m_schedule);
+    }
+    catch (PermutationFailure const& error)
     {
-      // Notify that we start a new program.
-      m_on_permutation_begin();
-      // Play one permutation.
-      m_permutation_string.clear();
+      // Only a release build gets here; with debug output on TP_ASSERT doesn't throw.
+      TP_REPORT_FAILURE("Permutation \"" << m_schedule << "\" failed assertion " << error.message() << ".");
+      m_on_permutation_end(m_schedule);
+      std::abort();
+    }
+    m_on_permutation_end(m_schedule);
+    m_number_of_permutations = 1;
+    m_number_of_steps = permutation.number_of_steps();
+  }
+
+  m_tree_estimate = nullptr;
+  m_limit = limit;
+
+  if (m_keep_exploring)
+    report_failures();
+
+  stop_threads();
+
+  if (m_checkpoint_report)
+    CheckpointSite::print_statistics(std::cout);
+
+  std::chrono::duration<double> const duration = std::chrono::steady_clock::now() - start_time;
+  write_statistics(duration.count());
+}
+
+// If the environment variable THREADPERMUTER_STATISTICS is set, append the statistics of the last run() to the file that it names.
+// This allows bench to measure the bundled test programs without changing them.
+void ThreadPermuter::write_statistics(double seconds) const
+{
+  char const* path = std::getenv("THREADPERMUTER_STATISTICS");
+  if (!path)
+    return;
+  std::ofstream file(path, std::ios::app);
+  file << "{\"permutations\": " << m_number_of_permutations << ", \"steps\": " << m_number_of_steps << ", \"seconds\": " << seconds << "}" << std::endl;
+}
+
+// Play permutations until there are none left (or, when partition is non-null, until there are none left in that partition).
+// If coordinator is non-null, failures and the number of permutations are reported to it and subtrees are handed over to it when it asks for them.
+void ThreadPermuter::explore(Permutation& permutation, Partition const* partition, Connection* coordinator)
+{
+  Debug(libcw_do.off());
+  m_number_of_permutations = 0;
+  m_number_of_redundant_permutations = 0;
+  m_number_of_steps = 0;
+  int prefix = 0;               // The number of prefixes (of partition->m_split_depth steps) that were played before.
+  bool owned = !partition || partition->m_worker == 0;
+  // With a coordinator: the number of (redundant) permutations that were played when each step of the current path got
+  // its thread (the steps beyond the end got theirs at the same time as the last one), and the numbers that were reported.
+  using counts_type = std::pair<int, int>;
+  std::vector<counts_type> path_counts;
+  counts_type reported{0, 0};
+  for (;;)
+  {
+    // Notify that we start a new program.
+    begin_permutation();
+    // Play one permutation.
+    m_schedule.clear();
 
-      bool failed = false;
+    bool failed = false;
+    bool covered = false;
+    PermutationFailure failure;
+    try
+    {
+      permutation.play(m_schedule);
+      // Permutations with fewer preemptions than the current bound were already reported.
+      covered = permutation.already_covered();
+      if (owned && !covered)
+      {
+        ++m_number_of_permutations;
+        m_number_of_steps += permutation.number_of_steps();
+        if (permutation.redundant())
+          ++m_number_of_redundant_permutations;
+      }
+      if (m_snapshots)
+        m_snapshots->finished(permutation.redundant());
+    }
+    catch (PermutationFailure const& error)
+    {
+      if (!owned)
+      {
+        // The worker that owns this prefix reports the failure. Let the other threads
+        // finish, which prunes the same steps as the owner does when it keeps exploring.
+        permutation.finish(m_schedule);
+      }
+      else
+      {
+        // When keeping on exploring, only the first failure at every site is printed here.
+        bool const new_failure = !m_keep_exploring || record_failure(error, true);
+        Debug(libcw_do.on());
+        if (new_failure)
+          TP_REPORT_FAILURE("Permutation \"" << m_schedule << "\" failed assertion " << error.message() << ".");
+        if (partition)
+        {
+          std::string line = "F" + m_schedule.str() + '\t' + error.message() + '\n';
+          [[maybe_unused]] ssize_t len = write(partition->m_fd, line.data(), line.size());
+        }
+        if (coordinator)
+          coordinator->send("FAIL " + m_schedule.str() + '\t' + error.message());
+        if (m_snapshots)
+        {
+          // The state that the permutation started with is gone, so it can't be run again.
+          m_snapshots->failed(m_schedule.str(), error.message());
+          Debug(libcw_do.off());
+        }
+        else if (m_keep_exploring)
+        {
+          // Let the other threads finish (on_permutation_end is passed all steps) and continue with the next permutation.
+          permutation.finish(m_schedule);
+          ++m_number_of_permutations;
+          m_number_of_steps += permutation.number_of_steps();
+          Debug(libcw_do.off());
+        }
+        else
+        {
+          failed = true;
+          failure = error;
+        }
+      }
+    }
+
+    // Notify that the program has finished.
+    if (((owned && !covered) || failed) && m_keep_exploring)
+    {
       try
       {
-        permutation.play(m_permutation_string);
-        ++number_of_permutations;
+        m_on_permutation_end(m_schedule);
       }
       catch (PermutationFailure const& error)
       {
-        Debug(libcw_do.on());
-        Dout(dc::notice, "Permutation \"" << m_permutation_string << "\" failed assertion " << error.message() << ".");
-        failed = true;  // Cause permutation to run again with debug output turned on.
-        permutation.m_debug_on = true;
+        if (record_failure(error, false))
+        {
+          Debug(libcw_do.on());
+          TP_REPORT_FAILURE("on_permutation_end of permutation \"" << m_schedule << "\" failed assertion " << error.message() << ".");
+          Debug(libcw_do.off());
+        }
+      }
+      catch (std::exception const& exception)
+      {
+        PermutationFailure const error(exception, "<on_permutation_end>");
+        if (record_failure(error, false))
+        {
+          Debug(libcw_do.on());
+          TP_REPORT_FAILURE("on_permutation_end of permutation \"" << m_schedule << "\" failed: " << error.message() << ".");
+          Debug(libcw_do.off());
+        }
       }
+    }
+    else if ((owned && !covered) || failed)
+      m_on_permutation_end(m_schedule);
 
-      // Notify that the program has finished.
-      m_on_permutation_end(m_permutation_string);
+    if (failed)
+    {
+      std::string const failing_permutation = m_schedule.str();
+      // Let the other threads finish, so that all threads start at the beginning of their test function again.
+      Schedule remaining_steps(m_threads.size());
+      permutation.finish(remaining_steps);
+      Debug(libcw_do.off());
+      std::string const minimized_permutation = minimize_failure(failing_permutation, failure);
+      Debug(libcw_do.on());
+#ifdef CWDEBUG
+      // Cause the (minimized) permutation to run again with debug output turned on.
+      if (minimized_permutation != failing_permutation)
+        permutation.program(minimized_permutation);
+      permutation.m_debug_on = true;
+      continue;
+#else
+      // Without debug output there is nothing to learn from running it again; stop like the ASSERT of a debug build would.
+      std::abort();
+#endif
+    }
 
-      // restrict variations to the first m_limit steps.
-      if (!failed && !permutation.next(m_limit))   // Continue with the next permutation, if any.
-        break;
+    // restrict variations to the first m_limit steps.
+    // Prefixes that are owned by another worker are skipped after playing them once.
+    int const limit = owned ? m_limit : std::min(m_limit, partition->m_split_depth);
+    if (!permutation.next(limit))       // Continue with the next permutation, if any.
+      break;
+
+    if (coordinator)
+    {
+      // The steps from first_new_step() on get their thread now.
+      path_counts.resize(permutation.first_new_step(), path_counts.empty() ? counts_type{0, 0} : path_counts.back());
+      path_counts.push_back({m_number_of_permutations, m_number_of_redundant_permutations});
     }
+
+    if (m_tree_estimate && !partition && !coordinator)
+      report_progress();
+
+    // Save the state of the search now and then.
+    if (m_search_state_file)
+      m_search_state_file->update(permutation, m_number_of_permutations, m_number_of_redundant_permutations);
+
+    // Continue from the deepest snapshot on the path of the next permutation, if any.
+    if (m_snapshots)
+      m_snapshots->next(permutation, m_schedule.str(permutation.first_new_step()));
+
+    // Give away the subtrees closest to the root when the coordinator asks for more work.
+    if (coordinator)
+    {
+      std::string request;
+      while (coordinator->read_line(request, false) == 1)
+      {
+        if (request != "STEAL")
+          continue;
+        std::vector<std::string> prefixes;
+        if (!permutation.split(limit, prefixes))
+        {
+          coordinator->send("STOLEN");
+          continue;
+        }
+        for (std::string const& prefix : prefixes)
+          coordinator->send("SPLIT " + prefix);
+        // Only the permutations that start with the steps below the new floor remain. Report the ones that were played
+        // outside of those; if this worker dies, whoever explores the remaining prefix again will report the others.
+        size_t const last_floor_step = permutation.floor() - 1;
+        counts_type const outside = last_floor_step < path_counts.size() ? path_counts[last_floor_step] : path_counts.back();
+        coordinator->send("STOLEN " + std::to_string(outside.first - reported.first) + ' ' + std::to_string(outside.second - reported.second) +
+            ' ' + permutation.floor_prefix());
+        reported = outside;
+      }
+    }
+
+    if (partition && permutation.first_new_step() < partition->m_split_depth)
+    {
+      ++prefix;
+      owned = prefix % partition->m_number_of_workers == partition->m_worker;
+    }
+  }
+  if (coordinator)
+    coordinator->send("DONE " + std::to_string(m_number_of_permutations - reported.first) + ' ' +
+        std::to_string(m_number_of_redundant_permutations - reported.second));
+  Debug(libcw_do.on());
+}
+
+namespace {
+
+// Print seconds as [<days>d ]hh:mm:ss.
+std::string format_duration(double seconds)
+{
+  long total = static_cast<long>(seconds + 0.5);
+  std::ostringstream result;
+  if (total >= 86400)
+    result << total / 86400 << "d ";
+  total %= 86400;
+  result << std::setfill('0') << std::setw(2) << total / 3600 << ':' << std::setw(2) << total / 60 % 60 << ':' << std::setw(2) << total % 60;
+  return result.str();
+}
+
+} // namespace
+
+void ThreadPermuter::probe(TreeEstimate& tree_estimate, int number_of_probes)
+{
+  // A separate Permutation, so that the search isn't disturbed. DPOR and sleep sets don't apply to random permutations.
+  Permutation permutation(m_threads);
+  if (!m_symmetry_classes.empty())
+    permutation.set_symmetry_classes(m_symmetry_classes);
+  permutation.set_chooser([&tree_estimate](threads_set_type runnable_threads, int si){ return tree_estimate.choose(runnable_threads, si); });
+  Schedule schedule(m_threads.size());
+  for (int i = 0; i < number_of_probes; ++i)
+  {
+    auto const start_time = std::chrono::steady_clock::now();
+    permutation.program({});
+    tree_estimate.begin_probe();
+    // The probes are not passed to on_permutation_end.
+    begin_permutation();
+    schedule.clear();
+    try
+    {
+      permutation.play(schedule);
+    }
+    catch (PermutationFailure const&)
+    {
+      // The search doesn't vary the steps after a failure either.
+      tree_estimate.failed();
+      permutation.finish(schedule);
+    }
+    std::chrono::duration<double> const duration = std::chrono::steady_clock::now() - start_time;
+    tree_estimate.end_probe(duration.count());
+  }
+}
+
+void ThreadPermuter::report_progress()
+{
+  auto const now = std::chrono::steady_clock::now();
+  if (now - m_last_progress < m_progress_interval)
+    return;
+  // Refine the estimate.
+  probe(*m_tree_estimate, m_progress_probes / 10 + 1);
+  m_last_progress = std::chrono::steady_clock::now();
+  std::chrono::duration<double> const elapsed = m_last_progress - m_explore_start;
+  double const played = m_number_of_permutations;
+  double const estimate = std::max(m_tree_estimate->permutations(m_limit), played);
+  double const per_second = played / elapsed.count();
+  std::cout << "Progress: " << m_number_of_permutations << " of about " << static_cast<long>(estimate) << " permutations (" <<
+    std::fixed << std::setprecision(1) << 100.0 * played / estimate << std::defaultfloat << std::setprecision(6) << "%), " <<
+    static_cast<long>(per_second) << " permutations/s, ETA " << format_duration((estimate - played) / per_second) << '.' << std::endl;
+}
+
+double ThreadPermuter::estimate_permutations(int number_of_probes)
+{
+  TreeEstimate tree_estimate((static_cast<uint64_t>(std::random_device{}()) << 32) | std::random_device{}());
+  start_threads(true);
+  Debug(libcw_do.off());
+  probe(tree_estimate, number_of_probes);
+  Debug(libcw_do.on());
+  stop_threads();
+  Dout(dc::notice, "Estimated " << tree_estimate.permutations(m_limit) << " permutations with " << number_of_probes << " probes.");
+  return tree_estimate.permutations(m_limit);
+}
+
+void ThreadPermuter::resume(std::string const& path)
+{
+  m_search_state_path = path;
+  run();
+}
+
+void ThreadPermuter::run_parallel(int number_of_workers, int split_depth)
+{
+  DoutEntering(dc::notice, "ThreadPermuter::run_parallel(" << number_of_workers << ", " << split_depth << ")");
+  // The set of prefixes must not depend on which subtrees were explored.
+  ASSERT(!m_dpor && !m_state_hash);
+
+  struct Worker
+  {
+    pid_t m_pid;
+    int m_fd;                   // The read end of the pipe from the worker.
+    std::string m_input;        // Everything that was read from m_fd.
+  };
+  std::vector<Worker> workers;
+
+  // Flush before forking, or buffered output would be written more than once.
+  std::cout.flush();
+  for (int worker = 0; worker < number_of_workers; ++worker)
+  {
+    int fds[2];
+    if (pipe(fds) == -1)
+      DoutFatal(dc::core|error_cf, "pipe");
+    pid_t pid = fork();
+    if (pid == -1)
+      DoutFatal(dc::core|error_cf, "fork");
+    if (pid == 0)
+    {
+      // Worker process.
+      close(fds[0]);
+      for (Worker const& w : workers)
+        close(w.m_fd);
+      Partition partition{worker, number_of_workers, split_depth, fds[1]};
+      Permutation permutation(m_threads);
+      configure(permutation);
+      start_threads(true);
+      explore(permutation, &partition);
+      stop_threads();
+      std::string line = "C" + std::to_string(m_number_of_permutations) + ' ' + std::to_string(m_number_of_redundant_permutations) + '\n';
+      [[maybe_unused]] ssize_t len = write(fds[1], line.data(), line.size());
+      close(fds[1]);
+      std::cout.flush();
+      _exit(0);
+    }
+    close(fds[1]);
+    workers.push_back({pid, fds[0], {}});
+  }
+
+  // Read everything the workers write until they all closed their pipe.
+  std::vector<pollfd> pollfds;
+  for (Worker const& worker : workers)
+    pollfds.push_back({worker.m_fd, POLLIN, 0});
+  size_t open_pipes = workers.size();
+  while (open_pipes > 0)
+  {
+    if (poll(pollfds.data(), pollfds.size(), -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      DoutFatal(dc::core|error_cf, "poll");
+    }
+    for (size_t w = 0; w < workers.size(); ++w)
+    {
+      if (pollfds[w].fd == -1 || !pollfds[w].revents)
+        continue;
+      char buf[4096];
+      ssize_t len = read(pollfds[w].fd, buf, sizeof(buf));
+      if (len > 0)
+        workers[w].m_input.append(buf, len);
+      else if (len == 0 || errno != EINTR)
+      {
+        close(pollfds[w].fd);
+        pollfds[w].fd = -1;
+        --open_pipes;
+      }
+    }
+  }
+
+  // Merge the results.
+  m_number_of_permutations = 0;
+  m_number_of_redundant_permutations = 0;
+  int number_of_failures = 0;
+  for (size_t w = 0; w < workers.size(); ++w)
+  {
+    Worker const& worker = workers[w];
+    int status;
+    while (waitpid(worker.m_pid, &status, 0) == -1 && errno == EINTR)
+      ;
+    bool finished = false;
+    std::istringstream input(worker.m_input);
+    std::string line;
+    while (std::getline(input, line))
+    {
+      if (line.empty())
+        continue;
+      if (line[0] == 'F')
+      {
+        size_t tab = line.find('\t');
+        ++number_of_failures;
+        TP_REPORT_FAILURE("Worker " << w << ": permutation \"" << line.substr(1, tab - 1) << "\" failed assertion " << line.substr(tab + 1) << ".");
+      }
+      else if (line[0] == 'C')
+      {
+        int permutations = 0, redundant = 0;
+        std::istringstream(line.substr(1)) >> permutations >> redundant;
+        m_number_of_permutations += permutations;
+        m_number_of_redundant_permutations += redundant;
+        finished = true;
+      }
+    }
+    if (!finished || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      TP_REPORT_FAILURE("Worker " << w << " did not finish" << (WIFSIGNALED(status) ? " (killed by signal " + std::to_string(WTERMSIG(status)) + ")" : "") << "; its part of the permutations was not completely explored.");
+  }
+  m_number_of_failures = number_of_failures;
+  Dout(dc::notice(m_number_of_redundant_permutations > 0), m_number_of_redundant_permutations << " permutations were only run to finish the threads (all threads were asleep).");
+  Dout(dc::notice|flush_cf, number_of_workers << " workers finished " << m_number_of_permutations << " permutations; " << number_of_failures << " failed.");
+}
+
+void ThreadPermuter::run_worker(std::string const& address)
+{
+  DoutEntering(dc::notice, "ThreadPermuter::run_worker(\"" << address << "\")");
+  ASSERT(!m_dpor && !m_state_hash);
+
+  // The coordinator might not be listening yet.
+  Connection coordinator;
+  for (int attempt = 0; attempt < 50; ++attempt)
+  {
+    coordinator = Connection::connect(address);
+    if (coordinator.fd() != -1)
+      break;
+    usleep(100000);
+  }
+  if (coordinator.fd() == -1)
+    DoutFatal(dc::core|error_cf, "Could not connect to \"" << address << "\"");
+
+  start_threads(true);
+  coordinator.send("READY");
+  std::string line;
+  while (coordinator.read_line(line, true) == 1 && line != "QUIT")
+  {
+    // A request to give away work that arrived after we finished.
+    if (line == "STEAL")
+    {
+      coordinator.send("STOLEN");
+      continue;
+    }
+    ASSERT(line.compare(0, 5, "WORK ") == 0);
+    std::string const prefix = line.substr(5);
+    Permutation permutation(m_threads);
+    configure(permutation);
+    if (!prefix.empty())
+      permutation.program(prefix);
+    // Threads beyond 'Z' take more than one character.
+    Schedule prefix_steps(m_threads.size());
+    prefix_steps.assign(prefix);
+    permutation.set_floor(prefix_steps.size());
+    explore(permutation, nullptr, &coordinator);
+  }
+  stop_threads();
+}
+
+std::string ThreadPermuter::minimize(std::string const& failing_permutation)
+{
+  DoutEntering(dc::notice, "ThreadPermuter::minimize(\"" << failing_permutation << "\")");
+  Permutation permutation(m_threads);
+  start_threads(true);
+  Debug(libcw_do.off());
+
+  std::string minimized_permutation = failing_permutation;
+  begin_permutation();
+  m_schedule.clear();
+  permutation.program(failing_permutation);
+  try
+  {
+    permutation.play(m_schedule);
     Debug(libcw_do.on());
-    if (m_limit == std::numeric_limits<int>::max())
-      Dout(dc::notice|flush_cf, "All " << number_of_permutations << " permutations finished.");
-    else
-      Dout(dc::notice|flush_cf, "Completed " << number_of_permutations << " number of permutations.");
+    TP_REPORT_FAILURE("Permutation \"" << failing_permutation << "\" doesn't fail.");
+    Debug(libcw_do.off());
   }
-  else
+  catch (PermutationFailure const& error)
   {
-    m_on_permutation_begin();
-    m_permutation_string.clear();
-    permutation.play(m_permutation_string);
-    m_on_permutation_end(m_permutation_string);
+    // Only keep the steps up to and including the one that failed.
+    std::string const failing_steps = m_schedule.str();
+    permutation.finish(m_schedule);
+    minimized_permutation = minimize_failure(failing_steps, error);
   }
 
-  for (thi_type thi(0); thi < end; ++thi)
-    m_threads[thi].stop();
+  Debug(libcw_do.on());
+  stop_threads();
+  return minimized_permutation;
+}
+
+// Add error, that happened while playing m_schedule, to m_failures. Returns true if this is the first failure at that site.
+bool ThreadPermuter::record_failure(PermutationFailure const& error, bool in_test_function)
+{
+  std::string const permutation = m_schedule.str();
+  for (Failure& failure : m_failures)
+  {
+    if (failure.m_line != error.line() || failure.m_file != error.file() || failure.m_message != error.what() || failure.m_in_test_function != in_test_function)
+      continue;
+    ++failure.m_count;
+    if (Minimizer::simpler(permutation, failure.m_permutation))
+      failure.m_permutation = permutation;
+    return false;
+  }
+  m_failures.push_back({error.what(), error.file(), error.line(), permutation, 1, in_test_function});
+  return true;
+}
+
+// Minimize the permutation of every failure in m_failures and print them.
+// All threads must be at the start of their test function.
+void ThreadPermuter::report_failures()
+{
+  Debug(libcw_do.off());
+  for (Failure& failure : m_failures)
+    if (failure.m_in_test_function)
+      failure.m_permutation = minimize_failure(failure.m_permutation, PermutationFailure(failure.m_message.c_str(), failure.m_file.c_str(), failure.m_line));
+  Debug(libcw_do.on());
+  if (m_failures.empty())
+    return;
+  TP_REPORT_FAILURE(m_failures.size() << " different failures were found:");
+  for (Failure const& failure : m_failures)
+    TP_REPORT_FAILURE("  \"" << failure.m_message << "\" in " << failure.m_file << ':' << failure.m_line <<
+        (failure.m_in_test_function ? "" : " (on_permutation_end)") << ": " << failure.m_count <<
+        " permutations, for example \"" << failure.m_permutation << "\".");
+}
+
+// Try simpler permutations that might fail the same way as failing_permutation, of which the last step failed with error.
+// All threads must be at the start of their test function and debug output must be off.
+std::string ThreadPermuter::minimize_failure(std::string const& failing_permutation, PermutationFailure const& error)
+{
+  Minimizer minimizer(failing_permutation);
+  Permutation permutation(m_threads);
+  permutation.set_chooser([&minimizer](threads_set_type runnable_threads, int si){ return minimizer.choose(runnable_threads, si); });
+  Schedule schedule(m_threads.size());
+  int replays = 0;
+  while (replays < m_max_minimize_replays && minimizer.next_candidate())
+  {
+    ++replays;
+    // The candidates are not passed to on_permutation_end.
+    begin_permutation();
+    schedule.clear();
+    permutation.program({});
+    try
+    {
+      permutation.play(schedule);
+      minimizer.result(schedule.str(), false);
+    }
+    catch (PermutationFailure const& candidate_error)
+    {
+      minimizer.result(schedule.str(), candidate_error.same_site(error));
+      permutation.finish(schedule);
+    }
+  }
+  std::string const minimized_permutation = minimizer.best();
+  Debug(libcw_do.on());
+  if (minimized_permutation != failing_permutation)
+    TP_REPORT_FAILURE("Minimized to \"" << minimized_permutation << "\" (" << Minimizer::context_switches(minimized_permutation) <<
+        " instead of " << Minimizer::context_switches(failing_permutation) << " context switches) after trying " << replays << " permutations.");
+  Debug(libcw_do.off());
+  return minimized_permutation;
+}
+
+void ThreadPermuter::run_pct(int number_of_runs, int depth, uint64_t seed)
+{
+  DoutEntering(dc::notice, "ThreadPermuter::run_pct(" << number_of_runs << ", " << depth << ", " << seed << ")");
+  if (seed == 0)
+    seed = (static_cast<uint64_t>(std::random_device{}()) << 32) | std::random_device{}();
+  Dout(dc::notice, "Using seed " << seed << ".");
+
+  Permutation permutation(m_threads);
+  start_threads(true);
+  Debug(libcw_do.off());
+
+  int number_of_failures = 0;
+
+  // Do one run with the default schedule to estimate the number of steps of a run.
+  begin_permutation();
+  m_schedule.clear();
+  permutation.program({});
+  try
+  {
+    permutation.play(m_schedule);
+  }
+  catch (PermutationFailure const& error)
+  {
+    Debug(libcw_do.on());
+    TP_REPORT_FAILURE("Permutation \"" << m_schedule << "\" (default schedule) failed assertion " << error.message() << ".");
+    Debug(libcw_do.off());
+    ++number_of_failures;
+    // Let the other threads finish; the steps that they do still count for the estimate.
+    permutation.finish(m_schedule);
+  }
+  m_on_permutation_end(m_schedule);
+  int const number_of_steps = permutation.number_of_steps();
+
+  for (int run = 0; run < number_of_runs; ++run)
+  {
+    uint64_t const run_seed = seed + run;
+    PctScheduler scheduler(run_seed, m_threads.size(), depth, number_of_steps);
+    permutation.program({});
+    permutation.set_chooser([&scheduler](threads_set_type runnable_threads, int si){ return scheduler.choose(runnable_threads, si); });
+    begin_permutation();
+    m_schedule.clear();
+    std::string failing_permutation;
+    PermutationFailure failure;
+    try
+    {
+      permutation.play(m_schedule);
+    }
+    catch (PermutationFailure const& error)
+    {
+      Debug(libcw_do.on());
+      TP_REPORT_FAILURE("Permutation \"" << m_schedule << "\" (PCT seed " << run_seed << ") failed assertion " << error.message() << ".");
+      Debug(libcw_do.off());
+      ++number_of_failures;
+      failing_permutation = m_schedule.str();
+      failure = error;
+      // Let the other threads finish, so that the next run starts with all threads at the start of their test function.
+      permutation.finish(m_schedule);
+    }
+    m_on_permutation_end(m_schedule);
+    if (!failing_permutation.empty())
+      minimize_failure(failing_permutation, failure);
+  }
+  permutation.set_chooser(nullptr);
+  Debug(libcw_do.on());
+  Dout(dc::notice|flush_cf, "Played " << number_of_runs << " PCT permutations of about " << number_of_steps << " steps with depth " << depth << "; " << number_of_failures << " failed.");
+  stop_threads();
 }
@@ -1,39 +1,233 @@
 #pragma once
 
 #include "Thread.h"
+#include "Schedule.h"
+#include "Arena.h"
+#include <vector>
 #include <functional>
 #include <string>
 #include <exception>
 #include <limits>
+#include <cstdint>
+#include <chrono>
 
 // An object of this type allows one to explore
 // the possible results of running two or more
 // functions simultaneously in different threads.
 //
+namespace thread_permuter {
+class Permutation;
+class Connection;
+class Task;
+class Snapshots;
+class SearchStateFile;
+class TreeEstimate;
+} // namespace thread_permuter
+
 class ThreadPermuter
 {
  public:
   using thi_type = ThreadIndex;
   using tests_type = utils::Vector<std::function<void()>, thi_type>;
+  using coroutine_tests_type = utils::Vector<std::function<thread_permuter::Task()>, thi_type>;
   using threads_type = utils::Vector<thread_permuter::Thread, thi_type>;
+  // The callback that is called after every permutation, with the permutation that was played.
+  using on_permutation_end_type = std::function<void(thread_permuter::ScheduleView)>;
+  // A callback that takes the permutation string instead. The string is reused for every permutation,
+  // so that this doesn't allocate memory per permutation either.
+  using on_permutation_end_string_type = std::function<void(std::string const&)>;
 
-  ThreadPermuter(std::function<void()> on_permutation_begin, tests_type const& tests, std::function<void(std::string const&)> on_permutation_end);
+  ThreadPermuter(std::function<void()> on_permutation_begin, tests_type const& tests, on_permutation_end_type on_permutation_end);
+  ThreadPermuter(std::function<void()> on_permutation_begin, tests_type const& tests, on_permutation_end_string_type on_permutation_end) :
+    ThreadPermuter(std::move(on_permutation_begin), tests, string_callback(std::move(on_permutation_end))) { }
+  // Use test functions that are coroutines (see Coroutine.h). This selects the thread_permuter::coroutine backend.
+  ThreadPermuter(std::function<void()> on_permutation_begin, coroutine_tests_type const& tests, on_permutation_end_type on_permutation_end);
+  ThreadPermuter(std::function<void()> on_permutation_begin, coroutine_tests_type const& tests, on_permutation_end_string_type on_permutation_end) :
+    ThreadPermuter(std::move(on_permutation_begin), tests, string_callback(std::move(on_permutation_end))) { }
   ~ThreadPermuter();
 
   void set_limit(int limit) { m_limit = limit; }
+  // Let run() pick the largest limit (but not larger than set_limit) for which all permutations are expected to be played
+  // within budget. The size of the search tree and the time per permutation are estimated with number_of_probes
+  // random permutations first (see thread_permuter::TreeEstimate).
+  void set_time_budget(std::chrono::seconds budget, int number_of_probes = 100) { m_time_budget = budget; m_budget_probes = number_of_probes; }
+  // Let run() print, every interval, the number of permutations played so far, the estimated total, the number of permutations
+  // per second and the expected remaining time. The total is estimated with number_of_probes random permutations before the
+  // search starts, and refined with a tenth of that at every report. Only the exhaustive search in a single process reports progress.
+  void set_progress(std::chrono::seconds interval, int number_of_probes = 100) { m_progress_interval = interval; m_progress_probes = number_of_probes; }
+  void set_dpor(bool dpor) { m_dpor = dpor; }  // Only explore reorderings of conflicting steps (see TPY_READ and TPY_WRITE).
+  void set_backend(thread_permuter::backend_type backend) { m_backend = backend; }      // Run normal test functions in threads or fibers.
+  // Run the test functions on the threads of pool instead of creating new threads for every run() (os_thread and futex backends).
+  void set_thread_pool(thread_permuter::ThreadPool& pool) { m_thread_pool = &pool; }
+  void set_sleep_sets(bool sleep_sets) { m_sleep_sets = sleep_sets; }   // Skip reorderings of independent steps that were already covered.
+  // Declare which test functions are identical: classes[thi] is the symmetry class of test thi (any number;
+  // tests with the same number run the same code on the same data). Permutations that only differ by
+  // swapping identical threads are then explored once; k identical threads divide the work by up to k!.
+  // Do not combine this with set_dpor or set_sleep_sets.
+  void set_symmetry_classes(std::vector<int> classes) { m_symmetry_classes = std::move(classes); }
+  // Prune the search when a state is reached that was visited before.
+  // The returned hash must cover everything that determines how the test continues, including relevant local variables of the test functions.
+  // Do not combine this with set_dpor or set_sleep_sets: those rely on the pruned subtree being explored.
+  void set_state_hash(std::function<uint64_t()> state_hash) { m_state_hash = std::move(state_hash); }
+  // Fork a snapshot of the process at new branch points of the search tree, so that the next permutation
+  // doesn't have to be replayed from the start but continues from the deepest snapshot on its path.
+  // At most budget snapshot processes are kept alive; the least recently used one is removed when there are more.
+  // This requires the fiber or coroutine backend. The callbacks are called in child processes, and
+  // failing permutations are reported but not rerun with debug output.
+  void set_snapshots(int budget) { m_snapshot_budget = budget; }
+  // Iterative context bounding: first explore all permutations without preemptions, then those with
+  // one preemption, etc, up to max_preemptions. A preemption is a switch to another thread while the
+  // thread that did the previous step could have continued. Most bugs need only a few of them, so
+  // these are found long before an exhaustive search would get to them.
+  // Do not combine this with set_dpor, set_sleep_sets or set_snapshots.
+  void set_max_preemptions(int max_preemptions) { m_max_preemptions = max_preemptions; }
+  // Let run() save the state of the search to path every interval, so that it can be resumed after a crash.
+  // The file is removed when all permutations were explored. If the file exists, run() continues from it.
+  // This only supports the exhaustive search in a single process (optionally with DPOR), not sleep sets:
+  // those compare the addresses of objects, which differ in the process that resumes.
+  void set_search_state_file(std::string const& path, std::chrono::seconds interval = std::chrono::seconds(60))
+    { m_search_state_path = path; m_search_state_interval = interval; }
+  // Let run() print, per checkpoint, how often it was visited, how often other threads could have run
+  // instead and how many permutations branched off there; the checkpoints that blow up the search most
+  // are listed first. When taking snapshots, only the steps played by the main process are counted.
+  void set_checkpoint_report(bool checkpoint_report) { m_checkpoint_report = checkpoint_report; }
+  // Don't stop at the first failure, but record it and continue with the next permutation.
+  // Permutations that start with the steps up to a failure are not played. Exceptions (other than
+  // PermutationFailure) that escape a test function, and failures thrown by on_permutation_end (use
+  // TP_ASSERT there), are recorded too. At the end of run() the failures are minimized and printed,
+  // one per site; see failures().
+  void set_keep_exploring(bool keep_exploring) { m_keep_exploring = keep_exploring; }
+  // After a failure, try at most max_replays simpler permutations that might fail the same TP_ASSERT
+  // (see thread_permuter::Minimizer); the simplest one that does is printed and, in a debug build,
+  // played again with debug output on. Zero turns this off. The default is 1000.
+  void set_max_minimize_replays(int max_replays) { m_max_minimize_replays = max_replays; }
+  // Let operator new of the test functions allocate from arena() (requires TP_ARENA_OPERATOR_NEW, see Arena.h).
+  void set_arena_operator_new(bool arena_operator_new) { m_arena_operator_new = arena_operator_new; }
+  // Continue an interrupted run() that used set_search_state_file(path) (or start one if the file doesn't exist).
+  void resume(std::string const& path);
   void run(std::string permutation = {}, bool continue_running = false, bool debug_on = false);
 
+  // Explore all permutations using number_of_workers forked processes.
+  //
+  // Every distinct sequence of the first split_depth steps (prefix) is explored by exactly one worker.
+  // Each worker still has to play one permutation of every prefix that it doesn't own, so split_depth
+  // should be chosen such that there are many more prefixes than workers, but each of them is still large.
+  // on_permutation_end is only called for, and failures are only reported by, the worker that owns the permutation.
+  // This only supports the exhaustive search (optionally with sleep sets), not DPOR or a state hash.
+  void run_parallel(int number_of_workers, int split_depth);
+
+  // Play number_of_probes random permutations and return the estimated number of permutations that run() will play.
+  // The probes are not passed to on_permutation_end. With DPOR, sleep sets or a state hash this is an upper bound.
+  double estimate_permutations(int number_of_probes = 100);
+
+  // Play the given permutation, that should fail a TP_ASSERT, and return the simplest permutation that was found that fails the same TP_ASSERT.
+  std::string minimize(std::string const& permutation);
+
+  // Play number_of_runs random permutations, chosen by the PCT algorithm with the given bug depth (see PctScheduler).
+  //
+  // Run i uses seed + i; zero means pick a random seed. The seed of a failing permutation is printed,
+  // so that it can be repeated with run_pct(1, depth, seed), but also the permutation itself, which
+  // can be passed to run(). Any limit, DPOR and sleep sets are ignored.
+  void run_pct(int number_of_runs, int depth, uint64_t seed = 0);
+
+  // Explore the parts of the search tree that are handed out by a thread_permuter::Coordinator listening on address.
+  //
+  // The worker keeps requesting work until the coordinator tells it to quit. When the coordinator asks
+  // for work to hand to another worker, the remaining subtrees closest to the root are given away.
+  // Like run_parallel, this does not support DPOR or a state hash.
+  void run_worker(std::string const& address);
+
+  // A distinct failure that was found by the last run() with set_keep_exploring(true).
+  struct Failure
+  {
+    std::string m_message;              // The failed assertion, or what() of the exception.
+    std::string m_file;                 // The source file of the TP_ASSERT, or where the exception was caught.
+    int m_line;                         // The line number of the TP_ASSERT, or zero.
+    std::string m_permutation;          // The simplest permutation that failed this way.
+    int m_count;                        // The number of permutations that failed this way.
+    bool m_in_test_function;            // False if the failure was thrown by on_permutation_end.
+  };
+  std::vector<Failure> const& failures() const { return m_failures; }
+
+  // Memory for fixtures that is reset before every call to on_permutation_begin (see thread_permuter::Arena).
+  thread_permuter::Arena& arena() { return m_arena; }
+
+  // The number of permutations, and the total number of steps of those, that were played by the last run().
+  int number_of_permutations() const { return m_number_of_permutations; }
+  long number_of_steps() const { return m_number_of_steps; }
+  // The number of failing permutations that were reported by the workers of the last run_parallel().
+  int number_of_failures() const { return m_number_of_failures; }
+
+ private:
+  // When exploring in parallel, the part of the search tree that is explored by the current process.
+  struct Partition
+  {
+    int m_worker;                       // The index of this worker.
+    int m_number_of_workers;            // The total number of workers.
+    int m_split_depth;                  // The number of steps that form a prefix.
+    int m_fd;                           // The write end of the pipe to the parent process.
+  };
+
+  static on_permutation_end_type string_callback(on_permutation_end_string_type on_permutation_end);
+  void configure(thread_permuter::Permutation& permutation) const;    // Apply the settings of this ThreadPermuter.
+  void start_threads(bool debug_off);
+  void stop_threads();
+  void begin_permutation();                                           // Reset the arena and call on_permutation_begin.
+  void explore(thread_permuter::Permutation& permutation, Partition const* partition, thread_permuter::Connection* coordinator = nullptr);
+  void write_statistics(double seconds) const;
+  std::string minimize_failure(std::string const& failing_permutation, PermutationFailure const& error);
+  bool record_failure(PermutationFailure const& error, bool in_test_function);
+  void report_failures();
+  void probe(thread_permuter::TreeEstimate& tree_estimate, int number_of_probes);        // Add number_of_probes probes to tree_estimate.
+  void report_progress();                                                               // Called by explore() after every permutation.
+
  private:
   threads_type m_threads;                                       // The functions, one for each thread, that need to be run.
   std::function<void()> m_on_permutation_begin;                 // This callback is called every time before a new permutation starts.
-  std::function<void(std::string const&)> m_on_permutation_end; // This callback is called every time after all tests finished,
+  on_permutation_end_type m_on_permutation_end;                 // This callback is called every time after all tests finished,
                                                                 // once for each possible permutation.
-  std::string m_permutation_string;                             // Records the permutation last executed by play().
+  thread_permuter::Schedule m_schedule;                         // Records the permutation last executed by play().
   int m_limit = std::numeric_limits<int>::max();
+  thread_permuter::backend_type m_backend = thread_permuter::os_thread;
+  thread_permuter::ThreadPool* m_thread_pool = nullptr;         // If set, the threads that run the test functions come from this pool.
+  bool m_dpor = false;
+  bool m_sleep_sets = false;
+  std::vector<int> m_symmetry_classes;                          // The symmetry class of each test, or empty if there is no symmetry.
+  std::function<uint64_t()> m_state_hash;                       // If set, called after every step to identify the current state.
+  int m_snapshot_budget = 0;                                    // The maximum number of snapshot processes, or zero if not taking snapshots.
+  thread_permuter::Snapshots* m_snapshots = nullptr;            // Non-null while exploring with snapshots.
+  std::string m_search_state_path;                              // If not empty, the file that the state of the search is saved to.
+  std::chrono::seconds m_search_state_interval{60};             // The time between saving the state of the search.
+  thread_permuter::SearchStateFile* m_search_state_file = nullptr; // Non-null while exploring with a search state file.
+  int m_max_preemptions = -1;                                   // The largest preemption bound of run(), or -1 if not bounding.
+  bool m_checkpoint_report = false;                             // Print the statistics of every checkpoint at the end of run().
+  int m_max_minimize_replays = 1000;                            // The maximum number of permutations played to minimize a failure.
+  bool m_keep_exploring = false;                                // Continue with the next permutation after a failure.
+  std::vector<Failure> m_failures;                              // The distinct failures of the last run(), if m_keep_exploring.
+  thread_permuter::Arena m_arena;                               // Memory that only lives for a single permutation.
+  bool m_arena_operator_new = false;                            // Route operator new of the test functions to m_arena.
+  std::chrono::seconds m_time_budget{0};                        // The time that run() may take, or zero if there is no budget.
+  int m_budget_probes = 100;                                    // The number of probes to choose the limit for m_time_budget with.
+  std::chrono::seconds m_progress_interval{0};                  // The time between progress reports, or zero if there are none.
+  int m_progress_probes = 100;                                  // The number of probes to estimate the size of the search with.
+  thread_permuter::TreeEstimate* m_tree_estimate = nullptr;     // Non-null while explore() reports progress.
+  std::chrono::steady_clock::time_point m_explore_start;        // When explore() started (if m_tree_estimate is set).
+  std::chrono::steady_clock::time_point m_last_progress;        // When progress was last reported.
+  int m_number_of_permutations;                                 // The number of permutations that were played by explore().
+  int m_number_of_redundant_permutations;                       // The number of those that were only run to finish the threads.
+  long m_number_of_steps = 0;                                   // The total number of steps of the permutations that were played by explore().
+  int m_number_of_failures = 0;                                 // The number of failing permutations of the last run_parallel().
 };
 
 #ifndef CWDEBUG
-#define TP_ASSERT(x) assert(x)
+// Without libcwd the engine reports the failing permutation (see TP_REPORT_FAILURE).
+#define TP_ASSERT(x) \
+  do \
+  { \
+    if (!(x)) \
+      throw PermutationFailure(#x, __FILE__, __LINE__); \
+  } \
+  while (0)
 #else
 #define TP_ASSERT(x) \
   do \
@@ -0,0 +1,117 @@
+#include "sys.h"
+#include "ThreadPool.h"
+#include "debug.h"
+#include <algorithm>
+#include <string>
+#include <climits>
+#include <cstring>
+#include <unistd.h>
+
+namespace thread_permuter {
+
+namespace {
+
+struct EntryArgs
+{
+  ThreadPool* m_pool;
+  ThreadPool::Worker* m_worker;
+};
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t stack_size) : m_stack_size(std::max(stack_size, static_cast<size_t>(PTHREAD_STACK_MIN))), m_pid(getpid())
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+  if (getpid() != m_pid)
+    return;                             // The threads were not forked.
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& worker : m_workers)
+    {
+      // Destroying the pool while it is still in use?
+      ASSERT(!worker->m_busy);
+      worker->m_quit = true;
+      worker->m_condition.notify_one();
+    }
+  }
+  for (auto& worker : m_workers)
+    pthread_join(worker->m_thread, nullptr);
+}
+
+//static
+void* ThreadPool::entry(void* arg)
+{
+  EntryArgs args = *static_cast<EntryArgs*>(arg);
+  delete static_cast<EntryArgs*>(arg);
+  args.m_pool->main(args.m_worker);
+  return nullptr;
+}
+
+void ThreadPool::main(Worker* worker)
+{
+  // Only done once per thread, no matter how many test functions it runs.
+  Debug(NAMESPACE_DEBUG::init_thread(std::string("pool") + std::to_string(worker->m_index)));
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;)
+  {
+    worker->m_condition.wait(lock, [worker]{ return worker->m_job || worker->m_quit; });
+    if (!worker->m_job)
+      break;
+    std::function<void()> job(std::move(worker->m_job));
+    worker->m_job = nullptr;
+    lock.unlock();
+    job();
+    job = nullptr;
+    lock.lock();
+    worker->m_done = true;
+    worker->m_condition.notify_all();
+  }
+}
+
+ThreadPool::Worker* ThreadPool::start(std::function<void()> job)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (getpid() != m_pid)
+  {
+    // Only the thread that called fork() exists in this process. Forget the others (without joining them).
+    for (auto& worker : m_workers)
+      worker.release();
+    m_workers.clear();
+    m_pid = getpid();
+  }
+  auto iter = std::find_if(m_workers.begin(), m_workers.end(), [](auto const& worker){ return !worker->m_busy; });
+  Worker* worker;
+  if (iter != m_workers.end())
+    worker = iter->get();
+  else
+  {
+    m_workers.push_back(std::make_unique<Worker>(m_workers.size()));
+    worker = m_workers.back().get();
+    // std::thread doesn't allow to choose the size of the stack.
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, m_stack_size);
+    int err = pthread_create(&worker->m_thread, &attr, &ThreadPool::entry, new EntryArgs{this, worker});
+    pthread_attr_destroy(&attr);
+    if (err != 0)
+      DoutFatal(dc::core, "pthread_create: " << std::strerror(err));
+    Dout(dc::notice, "Created pool thread " << worker->m_index << " with a stack of " << m_stack_size << " bytes.");
+  }
+  worker->m_busy = true;
+  worker->m_done = false;
+  worker->m_job = std::move(job);
+  worker->m_condition.notify_all();
+  return worker;
+}
+
+void ThreadPool::wait(Worker* worker)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  worker->m_condition.wait(lock, [worker]{ return worker->m_done; });
+  worker->m_busy = false;
+}
+
+} // namespace thread_permuter
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <pthread.h>
+#include <sys/types.h>
+
+namespace thread_permuter {
+
+// The default stack size of the threads of a ThreadPool.
+constexpr size_t pool_stack_size = 1024 * 1024;
+
+// OS threads that run the test functions of ThreadPermuter objects with the os_thread or futex backend.
+//
+// Normally every run() creates a std::thread per test function and joins it afterwards.
+// When a ThreadPool is passed to ThreadPermuter::set_thread_pool, a test function is instead
+// bound to an idle thread of the pool, which becomes idle again when run() stopped the threads.
+// Threads are only created when there is no idle one, so a program that runs many small
+// ThreadPermuter objects one after another only creates as many threads as the largest one needs.
+// Their stacks have the size that is passed to the constructor.
+//
+// The pool may be shared by ThreadPermuter objects that run in different threads.
+// A pool that is used in a forked process (see run_parallel) starts with no threads there.
+class ThreadPool
+{
+ public:
+  // A thread of the pool.
+  struct Worker
+  {
+    pthread_t m_thread;                 // The thread.
+    int m_index;                        // Used for debug output.
+    std::condition_variable m_condition; // Signaled when m_job is set or has returned, or m_quit is set.
+    std::function<void()> m_job;        // The function that must be run, or empty when the worker is idle or running it.
+    bool m_busy;                        // Set from the moment a job was assigned until wait() returned.
+    bool m_done;                        // Set when the job returned.
+    bool m_quit;                        // Set when the thread must exit.
+
+    Worker(int index) : m_index(index), m_busy(false), m_done(false), m_quit(false) { }
+  };
+
+ private:
+  size_t m_stack_size;                  // The stack size of new threads.
+  pid_t m_pid;                          // The process that the threads belong to.
+  std::mutex m_mutex;                   // Protects the members of all workers.
+  std::vector<std::unique_ptr<Worker>> m_workers;
+
+ public:
+  ThreadPool(size_t stack_size = pool_stack_size);
+  ~ThreadPool();
+
+  ThreadPool(ThreadPool const&) = delete;
+  ThreadPool& operator=(ThreadPool const&) = delete;
+
+  // Run job on an idle thread (created if there is none). The returned worker must be passed to wait().
+  Worker* start(std::function<void()> job);
+  // Wait until the job that was started on worker returned; the worker is then idle again.
+  void wait(Worker* worker);
+
+  // The number of threads that were created.
+  size_t size() const { return m_workers.size(); }
+  size_t stack_size() const { return m_stack_size; }
+
+ private:
+  void main(Worker* worker);            // The function that the threads run.
+  static void* entry(void* arg);
+};
+
+} // namespace thread_permuter
@@ -0,0 +1,64 @@
+#include "sys.h"
+#include "TreeEstimate.h"
+#include "debug.h"
+#include <algorithm>
+
+namespace thread_permuter {
+
+ThreadIndex TreeEstimate::choose(threads_set_type runnable_threads, int si)
+{
+  int const choices = runnable_threads.count();
+  if (m_recording)
+  {
+    // Steps that are forced (only one thread can run) also count, with a factor of one, so that m_factors[si] belongs to step si.
+    ASSERT(si == static_cast<int>(m_factors.size()));
+    m_factors.push_back(choices);
+  }
+  int n = std::uniform_int_distribution<int>(0, choices - 1)(m_random_number_generator);
+  for (;;)
+  {
+    ThreadIndex thi = runnable_threads.lssbi();
+    if (n-- == 0)
+      return thi;
+    runnable_threads &= ~index2mask(thi);
+  }
+}
+
+void TreeEstimate::end_probe(double seconds)
+{
+  // Before this probe, every limit beyond the longest probe so far has the same sum.
+  if (m_sums.size() < m_factors.size() + 1)
+    m_sums.resize(m_factors.size() + 1, m_sums.back());
+  double product = 1;
+  for (size_t limit = 0; limit < m_sums.size(); ++limit)
+  {
+    m_sums[limit] += product;
+    if (limit < m_factors.size())
+      product *= m_factors[limit];
+  }
+  ++m_number_of_probes;
+  m_seconds += seconds;
+  m_recording = false;
+}
+
+double TreeEstimate::permutations(int limit) const
+{
+  if (m_number_of_probes == 0)
+    return 0;
+  size_t const index = std::min(static_cast<size_t>(std::max(limit, 0)), m_sums.size() - 1);
+  return m_sums[index] / m_number_of_probes;
+}
+
+int TreeEstimate::largest_limit(double budget) const
+{
+  double const seconds_per_permutation = this->seconds_per_permutation();
+  if (permutations() * seconds_per_permutation <= budget)
+    return std::numeric_limits<int>::max();
+  // The estimate grows with the limit.
+  int limit = 0;
+  while (limit + 1 < static_cast<int>(m_sums.size()) && permutations(limit + 1) * seconds_per_permutation <= budget)
+    ++limit;
+  return limit;
+}
+
+} // namespace thread_permuter
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Thread.h"
+#include <random>
+#include <vector>
+#include <limits>
+#include <cstdint>
+
+namespace thread_permuter {
+
+// Estimates the number of permutations of an exhaustive search with random probes (Knuth, 1975).
+//
+// A probe plays a single permutation, choosing the thread of every step at random among the threads
+// that could run. The product of the number of choices at every step is an unbiased estimate of the
+// number of permutations (leaves of the search tree); the average over many probes converges to it.
+// Because only the first limit steps are varied by the search, the product of the first limit
+// factors is the estimate for that limit; one set of probes gives the estimates for every limit.
+// DPOR, sleep sets and a state hash make the search smaller; then the estimate is an upper bound.
+class TreeEstimate
+{
+ private:
+  std::mt19937_64 m_random_number_generator;
+  std::vector<double> m_sums;           // m_sums[limit]: the sum, over all probes, of the product of the first limit factors.
+  int m_number_of_probes;               // The number of probes that were added.
+  double m_seconds;                     // The total time that the probes took.
+  std::vector<int> m_factors;           // The number of choices at each step of the current probe.
+  bool m_recording;                     // Set while choose() records m_factors.
+
+ public:
+  TreeEstimate(uint64_t seed) : m_random_number_generator(seed), m_sums(1, 0.0), m_number_of_probes(0), m_seconds(0), m_recording(false) { }
+
+  // Start a new probe.
+  void begin_probe() { m_factors.clear(); m_recording = true; }
+  // Return a random thread of runnable_threads to do step si of the current probe.
+  ThreadIndex choose(threads_set_type runnable_threads, int si);
+  // The steps after a failure are not varied by the search; the threads are finished without recording them.
+  void failed() { m_recording = false; }
+  // Add the current probe, that took the given time.
+  void end_probe(double seconds);
+
+  int number_of_probes() const { return m_number_of_probes; }
+  // The estimated number of permutations when only the first limit steps are varied.
+  double permutations(int limit = std::numeric_limits<int>::max()) const;
+  // The average time that a permutation took.
+  double seconds_per_permutation() const { return m_number_of_probes == 0 ? 0 : m_seconds / m_number_of_probes; }
+  // The largest limit for which all permutations are expected to be played in budget seconds,
+  // or std::numeric_limits<int>::max() if that is the case without a limit.
+  int largest_limit(double budget) const;
+};
+
+} // namespace thread_permuter
@@ -0,0 +1,66 @@
+#include "sys.h"
+#include "VisitedStates.h"
+#include "debug.h"
+
+namespace thread_permuter {
+
+bool VisitedStates::visit(uint64_t key, int depth)
+{
+  if (key == 0)                 // Zero marks unused entries of m_table.
+  {
+    if (m_zero.m_key == 0)
+    {
+      m_zero = Entry{1, depth};
+      ++m_size;
+      return false;
+    }
+    return visited(m_zero, depth);
+  }
+  size_t const mask = m_table.size() - 1;
+  for (size_t i = key & mask;; i = (i + 1) & mask)
+  {
+    Entry& entry = m_table[i];
+    if (entry.m_key == key)
+      return visited(entry, depth);
+    if (entry.m_key == 0)
+    {
+      entry.m_key = key;
+      entry.m_depth = depth;
+      // Keep the load factor below 50% so that probe sequences stay short.
+      if (++m_size * 2 > m_table.size())
+        grow();
+      return false;
+    }
+  }
+}
+
+bool VisitedStates::visited(Entry& entry, int depth)
+{
+  if (entry.m_depth <= depth)
+  {
+    ++m_number_of_pruned;
+    return true;
+  }
+  // Reached earlier in the permutation than before; this subtree is larger.
+  entry.m_depth = depth;
+  return false;
+}
+
+void VisitedStates::grow()
+{
+  std::vector<Entry> old_table(m_table.size() * 2, Entry{0, 0});
+  old_table.swap(m_table);
+  size_t const mask = m_table.size() - 1;
+  for (Entry const& entry : old_table)
+  {
+    if (entry.m_key == 0)
+      continue;
+    size_t i = entry.m_key & mask;
+    while (m_table[i].m_key != 0)
+      i = (i + 1) & mask;
+    m_table[i] = entry;
+  }
+  Dout(dc::permutation, "VisitedStates grew to " << m_table.size() << " entries.");
+}
+
+} // namespace thread_permuter
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace thread_permuter {
+
+// A compact open-addressing hash table of visited states.
+//
+// Each entry stores the (64-bit) key of a state and the smallest step index at which
+// it was reached. A state reached again at the same or a larger step index has a
+// subtree that is (being) explored already and may be pruned.
+class VisitedStates
+{
+ private:
+  struct Entry
+  {
+    uint64_t m_key;             // The key of the state, or 0 if this entry is unused.
+    int m_depth;                // The smallest step index at which this state was reached.
+  };
+
+  std::vector<Entry> m_table;   // The size of this vector is always a power of two.
+  Entry m_zero;                 // The entry of key 0, which can't be stored in m_table (m_key is 1 when used).
+  size_t m_size;                // The number of used entries.
+  size_t m_number_of_pruned;    // The number of times visit() returned true.
+
+ public:
+  VisitedStates() : m_table(1024, Entry{0, 0}), m_zero{0, 0}, m_size(0), m_number_of_pruned(0) { }
+
+  // Returns true if key was already visited at a depth less than or equal depth.
+  bool visit(uint64_t key, int depth);
+
+  size_t size() const { return m_size; }
+  size_t number_of_pruned() const { return m_number_of_pruned; }
+
+ private:
+  bool visited(Entry& entry, int depth);        // The part of visit() for a key that was found.
+  void grow();
+};
+
+} // namespace thread_permuter
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <iomanip>
+
+namespace thread_permuter {
+
+// The index of a bit in a WideBitSet (the equivalent of utils::bitset::Index).
+struct WideIndex
+{
+  int m_index;
+  int operator()() const { return m_index; }
+};
+
+// A set of words * 64 bits, with the part of the interface of utils::BitSet that is used for sets of threads.
+//
+// Every operation is a loop over a fixed number of words without data dependent branches (except lssbi),
+// so that the compiler unrolls it and uses vector instructions where available.
+template<int words>
+class WideBitSet
+{
+ public:
+  using word_type = uint64_t;
+  static constexpr int bits_per_word = 64;
+  static constexpr int number_of_bits = words * bits_per_word;
+
+ private:
+  std::array<word_type, words> m_words;         // Bit i is stored in m_words[i / 64].
+
+ public:
+  WideBitSet() = default;
+  constexpr WideBitSet(word_type low_word) : m_words{low_word} { }
+
+  // Return a set with only bit index set.
+  static WideBitSet single(int index)
+  {
+    WideBitSet result(0);
+    result.m_words[index / bits_per_word] = word_type{1} << (index % bits_per_word);
+    return result;
+  }
+
+  // Return a set with all bits less than index set.
+  static WideBitSet below(int index)
+  {
+    WideBitSet result;
+    for (int w = 0; w < words; ++w)
+    {
+      int const bits = index - w * bits_per_word;
+      result.m_words[w] = bits >= bits_per_word ? ~word_type{0} : bits <= 0 ? word_type{0} : (word_type{1} << bits) - 1;
+    }
+    return result;
+  }
+
+  bool any() const
+  {
+    word_type combined = 0;
+    for (int w = 0; w < words; ++w)
+      combined |= m_words[w];
+    return combined != 0;
+  }
+  bool none() const { return !any(); }
+  void reset() { m_words.fill(0); }
+
+  int count() const
+  {
+    int result = 0;
+    for (int w = 0; w < words; ++w)
+      result += __builtin_popcountll(m_words[w]);
+    return result;
+  }
+  bool is_single_bit() const { return count() == 1; }
+
+  // The index of the least significant set bit. The set may not be empty.
+  WideIndex lssbi() const
+  {
+    for (int w = 0; w < words; ++w)
+      if (m_words[w])
+        return { w * bits_per_word + __builtin_ctzll(m_words[w]) };
+    return { -1 };
+  }
+
+  WideBitSet& operator|=(WideBitSet const& other) { for (int w = 0; w < words; ++w) m_words[w] |= other.m_words[w]; return *this; }
+  WideBitSet& operator&=(WideBitSet const& other) { for (int w = 0; w < words; ++w) m_words[w] &= other.m_words[w]; return *this; }
+  WideBitSet& operator^=(WideBitSet const& other) { for (int w = 0; w < words; ++w) m_words[w] ^= other.m_words[w]; return *this; }
+  WideBitSet operator~() const { WideBitSet result; for (int w = 0; w < words; ++w) result.m_words[w] = ~m_words[w]; return result; }
+
+  friend WideBitSet operator|(WideBitSet lhs, WideBitSet const& rhs) { return lhs |= rhs; }
+  friend WideBitSet operator&(WideBitSet lhs, WideBitSet const& rhs) { return lhs &= rhs; }
+  friend WideBitSet operator^(WideBitSet lhs, WideBitSet const& rhs) { return lhs ^= rhs; }
+
+  friend bool operator==(WideBitSet const& lhs, WideBitSet const& rhs) { return (lhs ^ rhs).none(); }
+  friend bool operator!=(WideBitSet const& lhs, WideBitSet const& rhs) { return !(lhs == rhs); }
+  // Compare as if the sets were (unsigned) integers.
+  friend bool operator<(WideBitSet const& lhs, WideBitSet const& rhs)
+  {
+    for (int w = words - 1; w >= 0; --w)
+      if (lhs.m_words[w] != rhs.m_words[w])
+        return lhs.m_words[w] < rhs.m_words[w];
+    return false;
+  }
+  friend bool operator>(WideBitSet const& lhs, WideBitSet const& rhs) { return rhs < lhs; }
+
+  friend std::ostream& operator<<(std::ostream& os, WideBitSet const& bit_set)
+  {
+    std::ios_base::fmtflags const flags = os.flags();
+    char const fill = os.fill('0');
+    os << std::hex;
+    for (int w = words - 1; w >= 0; --w)
+    {
+      if (w < words - 1)
+        os << std::setw(16);
+      os << bit_set.m_words[w];
+    }
+    os.fill(fill);
+    os.flags(flags);
+    return os;
+  }
+};
+
+} // namespace thread_permuter
@@ -0,0 +1,84 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+
+// Let the test functions allocate from ThreadPermuter::arena().
+TP_ARENA_OPERATOR_NEW
+
+thread_permuter::Arena* arena;
+
+// A fixture that is allocated from the arena every permutation.
+struct Log
+{
+  std::vector<char, thread_permuter::ArenaAllocator<char>> m_events;
+
+  Log(thread_permuter::Arena& arena) : m_events(arena) { }
+};
+
+struct TestRun
+{
+  Log* m_log;
+  int m_number_of_permutations = 0;
+  size_t m_capacity = 0;                // The capacity of the arena after the first permutation.
+
+  void on_permutation_begin()
+  {
+    m_log = arena->create<Log>(*arena);
+    m_log->m_events.reserve(8);
+  }
+
+  void on_permutation_end(std::string const& permutation)
+  {
+    // The callbacks are not routed to the arena.
+    std::unique_ptr<std::string> copy = std::make_unique<std::string>(permutation + " is longer than the small string buffer");
+    ASSERT(!arena->contains(copy.get()) && !arena->contains(copy->data()));
+    ASSERT(m_log->m_events.size() == 9);
+    if (++m_number_of_permutations == 1)
+      m_capacity = arena->capacity();
+  }
+};
+
+void test(TestRun& test_run, char name)
+{
+  for (int i = 0; i < 3; ++i)
+  {
+    // A heap allocation by the test function comes from the arena.
+    std::string* message = new std::string(1000, name);
+    TP_ASSERT(arena->contains(message) && arena->contains(message->data()));
+    test_run.m_log->m_events.push_back(name);
+    delete message;
+    TPY;
+  }
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  for (thread_permuter::backend_type backend : { thread_permuter::os_thread, thread_permuter::fiber })
+  {
+    TestRun test_run;
+    ThreadPermuter::tests_type tests =
+    {
+      [&]{ test(test_run, '0'); },
+      [&]{ test(test_run, '1'); },
+      [&]{ test(test_run, '2'); }
+    };
+    ThreadPermuter tp(
+        [&]{ test_run.on_permutation_begin(); },
+        tests,
+        [&](std::string const& permutation){ test_run.on_permutation_end(permutation); });
+    arena = &tp.arena();
+    tp.set_backend(backend);
+    tp.set_arena_operator_new(true);
+    tp.run();
+
+    std::cout << test_run.m_number_of_permutations << " permutations; the arena is " << arena->capacity() << " bytes." << std::endl;
+    // After the first permutation the arena didn't need more memory.
+    ASSERT(test_run.m_capacity > 0 && arena->capacity() == test_run.m_capacity);
+  }
+}
@@ -0,0 +1,59 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "PermuteFixture.h"
+#include <iostream>
+#include <vector>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Use more stack than a fiber has.
+int overflow(int depth)
+{
+  volatile char buffer[1024];
+  buffer[0] = static_cast<char>(depth);
+  return overflow(depth + 1) + buffer[0];
+}
+
+// A fiber that overflows its stack must hit the guard page below it.
+void test_stack_overflow()
+{
+  std::cout.flush();
+  pid_t const pid = fork();
+  if (pid == 0)
+  {
+    ThreadPermuter tp([]{}, { []{ overflow(0); } }, [](std::string const&){});
+    tp.set_backend(thread_permuter::fiber);
+    tp.run();
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  // Run the same exploration with every backend that can run normal functions.
+  std::vector<thread_permuter::backend_type> const backends = { thread_permuter::os_thread, thread_permuter::futex, thread_permuter::fiber };
+  std::vector<Exploration> const explorations = explore_modes({ "Threads", "Futex handoff", "Fibers" },
+      [&](int mode, PermuteFixture& fixture){
+        ThreadPermuter tp(
+            [&]{ fixture.on_permutation_begin(); },
+            fixture.tests(),
+            [&](std::string const& permutation_string){ fixture.on_permutation_end(permutation_string); });
+        tp.set_backend(backends[mode]);
+        tp.run();
+      });
+
+  for (size_t b = 1; b < explorations.size(); ++b)
+  {
+    ASSERT(explorations[b].m_number_of_permutations == explorations[0].m_number_of_permutations);
+    ASSERT(explorations[b].m_results == explorations[0].m_results);
+  }
+
+  test_stack_overflow();
+}
@@ -0,0 +1,241 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "Permutation.h"
+#include "Coroutine.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Measure the speed of the engine and print the results as JSON on stdout.
+//
+// Usage: bench [test...]
+//
+// Runs the given test programs (by default the bundled ones, which must be in the same directory as bench)
+// with their output discarded, and then does two microbenchmarks: the latency of a single step
+// for every backend and the cost of Permutation::next().
+
+namespace tp = thread_permuter;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+std::vector<clock_type::time_point> step_times;         // The time at which each step of the microbenchmark ended.
+
+struct Percentiles
+{
+  double m_p50;
+  double m_p99;
+  double m_mean;
+};
+
+Percentiles percentiles(std::vector<double>& samples)
+{
+  if (samples.empty())
+    return { 0, 0, 0 };
+  std::sort(samples.begin(), samples.end());
+  double sum = 0;
+  for (double sample : samples)
+    sum += sample;
+  return { samples[samples.size() / 2], samples[samples.size() * 99 / 100], sum / samples.size() };
+}
+
+// Run the test program path with its output discarded and return its results as a JSON object.
+std::string run_test(std::string const& name, std::string const& path)
+{
+  std::string const statistics_path = "/tmp/threadpermuter-bench." + std::to_string(getpid());
+  std::remove(statistics_path.c_str());
+  std::cout.flush();
+  auto const start_time = clock_type::now();
+  pid_t pid = fork();
+  if (pid == -1)
+    DoutFatal(dc::core|error_cf, "fork");
+  if (pid == 0)
+  {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 1);
+    dup2(null_fd, 2);
+    setenv("THREADPERMUTER_STATISTICS", statistics_path.c_str(), 1);
+    execl(path.c_str(), path.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  int status;
+  struct rusage usage;
+  while (wait4(pid, &status, 0, &usage) == -1 && errno == EINTR)
+    ;
+  std::chrono::duration<double> const wall_time = clock_type::now() - start_time;
+
+  // Add the statistics of every run() that the test did.
+  long permutations = 0;
+  long steps = 0;
+  double seconds = 0;
+  std::ifstream statistics(statistics_path);
+  std::string line;
+  while (std::getline(statistics, line))
+  {
+    long p, s;
+    double t;
+    if (std::sscanf(line.c_str(), "{\"permutations\": %ld, \"steps\": %ld, \"seconds\": %lf}", &p, &s, &t) == 3)
+    {
+      permutations += p;
+      steps += s;
+      seconds += t;
+    }
+  }
+  std::remove(statistics_path.c_str());
+
+  std::ostringstream json;
+  json << "{\"name\": \"" << name << "\", \"exit_status\": " << (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status)) <<
+    ", \"wall_seconds\": " << wall_time.count() << ", \"run_seconds\": " << seconds <<
+    ", \"permutations\": " << permutations << ", \"steps\": " << steps <<
+    ", \"permutations_per_second\": " << (seconds > 0 ? permutations / seconds : 0) <<
+    ", \"steps_per_second\": " << (seconds > 0 ? steps / seconds : 0) <<
+    ", \"peak_rss_kb\": " << usage.ru_maxrss << "}";
+  return json.str();
+}
+
+constexpr int handoff_steps = 20000;    // The number of steps of each thread in the handoff benchmark.
+
+void handoff_test()
+{
+  for (int i = 0; i < handoff_steps; ++i)
+  {
+    TPY;
+    step_times.push_back(clock_type::now());
+  }
+}
+
+tp::Task handoff_coroutine()
+{
+  for (int i = 0; i < handoff_steps; ++i)
+  {
+    co_await tp::yield();
+    step_times.push_back(clock_type::now());
+  }
+}
+
+// Play a single permutation of two threads that each do many steps, and return the latency of a step as a JSON object.
+std::string handoff(tp::backend_type backend, char const* name)
+{
+  step_times.clear();
+  step_times.reserve(2 * handoff_steps + 2);
+  auto on_permutation_begin = []{ step_times.push_back(clock_type::now()); };
+  auto on_permutation_end = [](tp::ScheduleView){};
+  auto run = [](ThreadPermuter& permuter){
+    permuter.set_limit(0);      // Only play the first permutation.
+    permuter.run();
+  };
+  if (backend == tp::coroutine)
+  {
+    ThreadPermuter::coroutine_tests_type tests = { handoff_coroutine, handoff_coroutine };
+    ThreadPermuter permuter(on_permutation_begin, tests, on_permutation_end);
+    run(permuter);
+  }
+  else
+  {
+    ThreadPermuter::tests_type tests = { handoff_test, handoff_test };
+    ThreadPermuter permuter(on_permutation_begin, tests, on_permutation_end);
+    permuter.set_backend(backend);
+    run(permuter);
+  }
+  std::vector<double> latencies;
+  for (size_t i = 1; i < step_times.size(); ++i)
+    latencies.push_back(std::chrono::duration<double, std::nano>(step_times[i] - step_times[i - 1]).count());
+  std::chrono::duration<double> const total = step_times.back() - step_times.front();
+  Percentiles const p = percentiles(latencies);
+  std::ostringstream json;
+  json << "{\"backend\": \"" << name << "\", \"steps\": " << latencies.size() <<
+    ", \"steps_per_second\": " << latencies.size() / total.count() <<
+    ", \"p50_ns\": " << p.m_p50 << ", \"p99_ns\": " << p.m_p99 << "}";
+  return json.str();
+}
+
+void next_test()
+{
+  for (int i = 0; i < 3; ++i)
+    TPY;
+}
+
+// Measure Permutation::next() while exploring all permutations of three threads, and return the result as a JSON object.
+std::string next_cost()
+{
+  ThreadPermuter::tests_type tests = { next_test, next_test, next_test };
+  std::vector<std::pair<std::function<void()>, ThreadIndex>> vp;
+  for (ThreadIndex thi = tests.ibegin(); thi != tests.iend(); ++thi)
+    vp.emplace_back(tests[thi], thi);
+  ThreadPermuter::threads_type threads(vp.begin(), vp.end());
+  for (ThreadIndex thi = threads.ibegin(); thi != threads.iend(); ++thi)
+    threads[thi].start(tp::thi_to_char(thi), true, tp::fiber);
+
+  tp::Permutation permutation(threads);
+  tp::Schedule schedule(threads.size());
+  std::vector<double> costs;
+  bool more;
+  do
+  {
+    schedule.clear();
+    permutation.play(schedule);
+    auto const start_time = clock_type::now();
+    more = permutation.next(std::numeric_limits<int>::max());
+    costs.push_back(std::chrono::duration<double, std::nano>(clock_type::now() - start_time).count());
+  }
+  while (more);
+
+  for (ThreadIndex thi = threads.ibegin(); thi != threads.iend(); ++thi)
+    threads[thi].stop();
+
+  Percentiles const p = percentiles(costs);
+  std::ostringstream json;
+  json << "{\"calls\": " << costs.size() << ", \"mean_ns\": " << p.m_mean << ", \"p50_ns\": " << p.m_p50 << ", \"p99_ns\": " << p.m_p99 << "}";
+  return json.str();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+  Debug(libcw_do.off());
+
+  std::vector<std::string> names;
+  for (int i = 1; i < argc; ++i)
+    names.push_back(argv[i]);
+  if (names.empty())
+    names = { "permute_test", "FuzzyLock_test", "StateChanger_test", "StreamBufReset_test", "RWLock_test" };
+
+  std::string directory = argv[0];
+  size_t const slash = directory.rfind('/');
+  directory = slash == std::string::npos ? "." : directory.substr(0, slash);
+
+  // The engine prints a line for every 1000 permutations; keep stdout for the JSON.
+  std::streambuf* const cout_buf = std::cout.rdbuf();
+  std::ostringstream json;
+
+  json << "{\n  \"tests\": [";
+  for (size_t i = 0; i < names.size(); ++i)
+    json << (i ? "," : "") << "\n    " << run_test(names[i], directory + '/' + names[i]);
+
+  std::ostringstream discarded;
+  std::cout.rdbuf(discarded.rdbuf());
+  json << "\n  ],\n  \"handoff\": [\n    " <<
+    handoff(tp::os_thread, "os_thread") << ",\n    " <<
+    handoff(tp::futex, "futex") << ",\n    " <<
+    handoff(tp::fiber, "fiber") << ",\n    " <<
+    handoff(tp::coroutine, "coroutine") << "\n  ],\n";
+  json << "  \"next\": " << next_cost() << "\n}\n";
+  std::cout.rdbuf(cout_buf);
+
+  std::cout << json.str();
+}
@@ -0,0 +1,67 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+
+int busy_line;                  // The line of the checkpoint in busy().
+
+// Thread 0 yields in a loop, which multiplies the number of permutations;
+// thread 1 only has a single checkpoint.
+void busy()
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    busy_line = __LINE__; TPY;  // This checkpoint should top the report.
+  }
+}
+
+void quiet()
+{
+  TPY;
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  int number_of_permutations = 0;
+  ThreadPermuter::tests_type tests = { busy, quiet };
+  ThreadPermuter tp([]{}, tests, [&](std::string const&){ ++number_of_permutations; });
+  tp.set_backend(thread_permuter::fiber);
+  tp.set_checkpoint_report(true);
+  tp.run();
+
+  std::ostringstream report;
+  thread_permuter::CheckpointSite::print_statistics(report);
+
+  // Parse the report; skip the header.
+  std::istringstream lines(report.str());
+  std::string line;
+  std::getline(lines, line);
+  long total_permutations = 0;
+  long total_visits = 0;
+  std::string first_site;
+  while (std::getline(lines, line))
+  {
+    std::istringstream fields(line);
+    long permutations, branches, visits;
+    fields >> permutations >> branches >> visits;
+    ASSERT(fields && branches <= visits && permutations <= visits);
+    total_permutations += permutations;
+    total_visits += visits;
+    if (first_site.empty())
+      std::getline(fields >> std::ws, first_site);
+  }
+  std::cout << report.str() << std::flush;
+
+  // Every permutation branched off at exactly one checkpoint.
+  ASSERT(total_permutations == number_of_permutations);
+  ASSERT(total_visits == tp.number_of_steps());
+  ASSERT(first_site == "TPY at " __FILE__ ":" + std::to_string(busy_line));
+  // The same checkpoint always gets the same site.
+  ASSERT(thread_permuter::CheckpointSite::lookup("co_await yield()", __FILE__, 1).id() ==
+         thread_permuter::CheckpointSite::lookup("co_await yield()", __FILE__, 1).id());
+  std::cout << "Success: " << number_of_permutations << " permutations." << std::endl;
+}
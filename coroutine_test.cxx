@@ -0,0 +1,58 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "Coroutine.h"
+#include "PermuteFixture.h"
+#include <iostream>
+
+// The test of PermuteFixture, as a coroutine.
+tp::Task locked_apply(PermuteFixture& fixture, tp::CoroutineMutex& mutex, int n)
+{
+  co_await mutex.lock();
+  co_await tp::yield();
+
+  fixture.apply(n);
+  co_await tp::yield();
+
+  mutex.unlock();
+}
+
+tp::Task coroutine_test(PermuteFixture& fixture, tp::CoroutineMutex& mutex, int n)
+{
+  // Awaiting a nested Task runs its steps as part of this test function.
+  co_await locked_apply(fixture, mutex, n);
+  co_await tp::yield();
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::vector<Exploration> const explorations = explore_modes({ "Threads", "Coroutines" },
+      [](int mode, PermuteFixture& fixture){
+        if (mode == 0)
+        {
+          ThreadPermuter tp(
+              [&]{ fixture.on_permutation_begin(); },
+              fixture.tests(),
+              [&](std::string const& permutation_string){ fixture.on_permutation_end(permutation_string); });
+          tp.run();
+          return;
+        }
+        tp::CoroutineMutex mutex;
+        ThreadPermuter::coroutine_tests_type tests =
+        {
+          [&]{ return coroutine_test(fixture, mutex, 0); },
+          [&]{ return coroutine_test(fixture, mutex, 1); },
+          [&]{ return coroutine_test(fixture, mutex, 2); }
+        };
+        ThreadPermuter tp(
+            [&]{ fixture.on_permutation_begin(); },
+            tests,
+            [&](std::string const& permutation_string){ fixture.on_permutation_end(permutation_string); });
+        tp.run();
+      });
+
+  ASSERT(explorations[0].m_number_of_permutations == explorations[1].m_number_of_permutations);
+  ASSERT(explorations[0].m_results == explorations[1].m_results);
+}
@@ -0,0 +1,171 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "ConditionVariable.h"
+#include <iostream>
+#include <mutex>
+
+using thread_permuter::Mutex;
+using thread_permuter::ConditionVariable;
+
+// Two threads that lock two mutexes in opposite order.
+Mutex m1;
+Mutex m2;
+
+void lock12()
+{
+  std::lock_guard<Mutex> lock1(m1);
+  TPY;
+  std::lock_guard<Mutex> lock2(m2);
+  TPY;
+}
+
+void lock21()
+{
+  m2.lock();            // The unwinding of an abandoned thread also unlocks mutexes that aren't held with a lock guard.
+  TPY;
+  m1.lock();
+  TPY;
+  m1.unlock();
+  m2.unlock();
+}
+
+// A lost wake up: the waiter checks ready, and only then starts waiting.
+Mutex m;
+ConditionVariable cv;
+bool ready;
+
+void waiter()
+{
+  bool was_ready;
+  {
+    std::lock_guard<Mutex> lock(m);
+    was_ready = ready;
+  }
+  TPY;
+  if (!was_ready)
+  {
+    std::unique_lock<Mutex> lock(m);
+    cv.wait(lock);
+  }
+}
+
+void notifier()
+{
+  {
+    std::lock_guard<Mutex> lock(m);
+    ready = true;
+  }
+  cv.notify_one();
+}
+
+// Two notifiers and one waiter that waits until both notified. This never dead locks.
+int notified;
+bool done;
+
+void waiter_with_predicate()
+{
+  std::unique_lock<Mutex> lock(m);
+  cv.wait(lock, []{ return notified == 2; });
+  done = true;
+}
+
+void notifier_one()
+{
+  {
+    std::lock_guard<Mutex> lock(m);
+    ++notified;
+  }
+  cv.notify_one();
+}
+
+// The waiter holds m2 while it waits, and the notifier locks m2 while it holds m. After notify_one
+// the waiter can't get m back, so the notifier is abandoned while it is still inside notify_one.
+
+void waiter_holding_m2()
+{
+  std::lock_guard<Mutex> lock2(m2);
+  std::unique_lock<Mutex> lock(m);
+  cv.wait(lock, []{ return ready; });
+}
+
+void notifier_locking_m2()
+{
+  TPY;
+  std::lock_guard<Mutex> lock(m);
+  ready = true;
+  cv.notify_one();
+  std::lock_guard<Mutex> lock2(m2);
+}
+
+int count_dead_locks(ThreadPermuter const& tp)
+{
+  int number_of_dead_locks = 0;
+  for (ThreadPermuter::Failure const& failure : tp.failures())
+  {
+    std::cout << '"' << failure.m_message << "\": " << failure.m_count << " times, for example \"" << failure.m_permutation << "\"." << std::endl;
+    ASSERT(failure.m_file == "<dead lock>");
+    number_of_dead_locks += failure.m_count;
+  }
+  return number_of_dead_locks;
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  for (thread_permuter::backend_type backend : { thread_permuter::fiber, thread_permuter::os_thread })
+  {
+    ThreadPermuter::tests_type tests = { lock12, lock21 };
+    ThreadPermuter tp([]{}, tests, [](std::string const&){});
+    tp.set_backend(backend);
+    tp.set_keep_exploring(true);
+    tp.run();
+    int const number_of_dead_locks = count_dead_locks(tp);
+    std::cout << tp.number_of_permutations() << " permutations, of which " << number_of_dead_locks << " dead locked." << std::endl;
+    // The dead lock is reported once, with its cycle, and the other permutations were still explored.
+    ASSERT(tp.failures().size() == 1);
+    ASSERT(tp.failures()[0].m_message.find("wait-for cycle 0 -> 1 -> 0") != std::string::npos);
+    ASSERT(number_of_dead_locks > 0 && number_of_dead_locks < tp.number_of_permutations());
+  }
+
+  ThreadPermuter::tests_type tests = { waiter, notifier };
+  ThreadPermuter tp([]{ ready = false; }, tests, [](std::string const&){});
+  tp.set_backend(thread_permuter::fiber);
+  tp.set_keep_exploring(true);
+  tp.run();
+  int const number_of_dead_locks = count_dead_locks(tp);
+  std::cout << tp.number_of_permutations() << " permutations, of which " << number_of_dead_locks << " dead locked." << std::endl;
+  ASSERT(tp.failures().size() == 1);
+  ASSERT(tp.failures()[0].m_message.find("thread 0 waits on condition variable") != std::string::npos);
+  ASSERT(number_of_dead_locks > 0 && number_of_dead_locks < tp.number_of_permutations());
+
+  {
+    ThreadPermuter::tests_type tests = { waiter_with_predicate, notifier_one, notifier_one };
+    ThreadPermuter tp([]{ notified = 0; done = false; }, tests, [](std::string const&){ TP_ASSERT(done); });
+    tp.set_backend(thread_permuter::fiber);
+    tp.set_keep_exploring(true);
+    tp.run();
+    std::cout << tp.number_of_permutations() << " permutations with two notifiers." << std::endl;
+    ASSERT(count_dead_locks(tp) == 0);
+  }
+
+  {
+    ThreadPermuter::tests_type tests = { waiter_holding_m2, notifier_locking_m2 };
+    ThreadPermuter tp([]{ ready = false; }, tests, [](std::string const&){});
+    tp.set_backend(thread_permuter::fiber);
+    tp.set_keep_exploring(true);
+    tp.run();
+    int const number_of_dead_locks = count_dead_locks(tp);
+    std::cout << tp.number_of_permutations() << " permutations, of which " << number_of_dead_locks << " dead locked." << std::endl;
+    bool inside_notify = false;
+    for (ThreadPermuter::Failure const& failure : tp.failures())
+      if (failure.m_message.find("thread 1 notified condition variable") != std::string::npos)
+      {
+        inside_notify = true;
+        ASSERT(failure.m_message.find("wait-for cycle 0 -> 1 -> 0") != std::string::npos);
+      }
+    ASSERT(inside_notify);
+    ASSERT(number_of_dead_locks > 0 && number_of_dead_locks < tp.number_of_permutations());
+  }
+}
@@ -0,0 +1,124 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "Coordinator.h"
+#include "PermuteFixture.h"
+#include <unistd.h>
+#include <sys/wait.h>
+#include <iostream>
+
+// The fixture, with a worker process that can die.
+struct TestRun : PermuteFixture
+{
+  int m_exit_after = -1;                // If non-negative, the process exits when this many permutations were played.
+  int m_exit_fd = -1;                   // If not -1, a byte is written here when half of those were played.
+
+  void on_permutation_end(std::string const& permutation_string)
+  {
+    PermuteFixture::on_permutation_end(permutation_string);
+    if (m_exit_fd != -1 && m_number_of_permutations == m_exit_after / 2)
+      [[maybe_unused]] ssize_t len = write(m_exit_fd, "", 1);
+    if (m_number_of_permutations == m_exit_after)
+      _exit(1);
+  }
+};
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  TestRun test_run;
+
+  ThreadPermuter tp(
+      [&]{ test_run.on_permutation_begin(); },
+      test_run.tests(),
+      [&](std::string const& permutation_string){ test_run.on_permutation_end(permutation_string); });
+
+  // Count the permutations of a serial run.
+  tp.run();
+  int const serial = test_run.m_number_of_permutations;
+
+  // Let three local worker processes explore the same tree, handed out by a coordinator.
+  std::string const address = "unix:/tmp/distributed_test." + std::to_string(getpid());
+  thread_permuter::Coordinator coordinator(address);
+  int const number_of_workers = 3;
+  std::cout << std::flush;
+  for (int worker = 0; worker < number_of_workers; ++worker)
+  {
+    if (fork() == 0)
+    {
+      tp.run_worker(address);
+      _exit(0);
+    }
+  }
+  coordinator.run();
+  for (int worker = 0; worker < number_of_workers; ++worker)
+    wait(nullptr);
+
+  std::cout << "Serial: " << serial << " permutations; distributed: " << coordinator.number_of_permutations() << " permutations." << std::endl;
+  ASSERT(coordinator.number_of_permutations() == serial);
+  ASSERT(coordinator.failures().empty() && coordinator.number_of_reassigned_prefixes() == 0);
+
+  // Again, but now the first worker dies half way its prefix. The other workers connect once it played
+  // half of the permutations that it will play, so that they steal part of its work before it dies.
+  std::string const address2 = address + ".2";
+  thread_permuter::Coordinator coordinator2(address2);
+  int fds[2];
+  [[maybe_unused]] int const res = pipe(fds);
+  ASSERT(res == 0);
+  std::cout << std::flush;
+  if (fork() == 0)
+  {
+    close(fds[0]);
+    test_run.m_exit_after = test_run.m_number_of_permutations + 2000;
+    test_run.m_exit_fd = fds[1];
+    tp.run_worker(address2);
+    _exit(0);
+  }
+  close(fds[1]);
+  for (int worker = 1; worker < number_of_workers; ++worker)
+  {
+    if (fork() == 0)
+    {
+      char c;
+      [[maybe_unused]] ssize_t len = read(fds[0], &c, 1);
+      tp.run_worker(address2);
+      _exit(0);
+    }
+  }
+  close(fds[0]);
+  coordinator2.run();
+  for (int worker = 0; worker < number_of_workers; ++worker)
+    wait(nullptr);
+
+  std::cout << "With a dying worker: " << coordinator2.number_of_permutations() << " permutations; " <<
+    coordinator2.number_of_reassigned_prefixes() << " prefixes were handed out again." << std::endl;
+  ASSERT(coordinator2.number_of_permutations() == serial);
+  ASSERT(coordinator2.failures().empty() && coordinator2.number_of_reassigned_prefixes() == 1);
+
+  // Finally, let some permutations fail. A worker stops at its first failure, so its prefix is not handed
+  // out again; the coordinator keeps the reported failures and returns once all workers are gone or done.
+  std::string const address3 = address + ".3";
+  thread_permuter::Coordinator coordinator3(address3);
+  test_run.m_exit_after = -1;
+  test_run.m_exit_fd = -1;
+  test_run.m_fail_on_zero = true;
+  tp.set_max_minimize_replays(0);
+  std::cout << std::flush;
+  for (int worker = 0; worker < number_of_workers; ++worker)
+  {
+    if (fork() == 0)
+    {
+      tp.run_worker(address3);
+      _exit(0);
+    }
+  }
+  coordinator3.run();
+  for (int worker = 0; worker < number_of_workers; ++worker)
+    wait(nullptr);
+
+  std::cout << "With failures: " << coordinator3.failures().size() << " failures reported; " <<
+    coordinator3.unexplored_prefixes().size() << " prefixes were not explored." << std::endl;
+  ASSERT(!coordinator3.failures().empty() && !coordinator3.unexplored_prefixes().empty());
+  ASSERT(coordinator3.number_of_reassigned_prefixes() == 0);
+}
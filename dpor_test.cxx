@@ -0,0 +1,98 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <set>
+#include <iostream>
+
+// Each thread increments its own counter and adds it to a shared total once.
+// Only the accesses to m_total conflict, so with DPOR only the order in which the threads
+// add to m_total (and read it back) needs to be varied.
+struct TestRun
+{
+  int m_counter[3];
+  int m_total;
+  int m_last_seen[3];
+  int m_number_of_permutations;
+  std::set<std::string> m_results;
+
+  void on_permutation_begin();
+  void on_permutation_end(std::string const& permutation_string);
+
+  void test(int n);
+};
+
+void TestRun::on_permutation_begin()
+{
+  DoutEntering(dc::notice|flush_cf, "on_permutation_begin()");
+  for (int n = 0; n < 3; ++n)
+    m_counter[n] = m_last_seen[n] = 0;
+  m_total = 0;
+}
+
+void TestRun::on_permutation_end(std::string const& permutation_string)
+{
+  DoutEntering(dc::notice|flush_cf, "on_permutation_end(\"" << permutation_string << "\")");
+  ASSERT(m_total % 2 == 0 && 2 <= m_total && m_total <= 6);
+  std::string result;
+  for (int n = 0; n < 3; ++n)
+    result += std::to_string(m_last_seen[n]) + ' ';
+  Dout(dc::notice|flush_cf, "Result: " << result);
+  m_results.insert(result);
+  ++m_number_of_permutations;
+}
+
+void TestRun::test(int n)
+{
+  DoutEntering(dc::notice|flush_cf, "TestRun::test(" << n << ")");
+
+  m_counter[n] += 2;
+  TPY_WRITE(&m_counter[n]);
+
+  int total = m_total;
+  TPY_READ(&m_total);
+
+  m_total = total + m_counter[n];
+  m_last_seen[n] = m_total;
+  TP_READ(&m_counter[n]);
+  TP_WRITE(&m_last_seen[n]);
+  TPY_WRITE(&m_total);
+
+  TP_LOCAL;     // Returning from this function doesn't access anything shared.
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::set<std::string> results[2];
+  int number_of_permutations[2];
+
+  for (int dpor = 0; dpor < 2; ++dpor)
+  {
+    TestRun test_run;
+    test_run.m_number_of_permutations = 0;
+
+    ThreadPermuter::tests_type tests =
+    {
+      [&test_run]{ test_run.test(0); },
+      [&test_run]{ test_run.test(1); },
+      [&test_run]{ test_run.test(2); }
+    };
+
+    ThreadPermuter tp(
+        [&]{ test_run.on_permutation_begin(); },
+        tests,
+        [&](std::string const& permutation_string){ test_run.on_permutation_end(permutation_string); });
+
+    tp.set_dpor(dpor);
+    tp.run();
+
+    results[dpor] = test_run.m_results;
+    number_of_permutations[dpor] = test_run.m_number_of_permutations;
+  }
+
+  std::cout << "Exhaustive: " << number_of_permutations[0] << " permutations, " << results[0].size() << " different results." << std::endl;
+  std::cout << "DPOR: " << number_of_permutations[1] << " permutations, " << results[1].size() << " different results." << std::endl;
+  // DPOR must find every result that the exhaustive search found.
+  ASSERT(results[0] == results[1]);
+}
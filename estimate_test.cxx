@@ -0,0 +1,48 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <iostream>
+#include <chrono>
+#include <cmath>
+
+// Three threads of three steps each, plus their finish step: 12! / (4! 4! 4!) = 34650 permutations.
+void test()
+{
+  for (int i = 0; i < 3; ++i)
+    TPY;
+}
+
+void long_test()
+{
+  for (int i = 0; i < 5; ++i)
+    TPY;
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  ThreadPermuter::tests_type tests = { test, test, test };
+  int number_of_permutations = 0;
+  ThreadPermuter tp([]{}, tests, [&](std::string const&){ ++number_of_permutations; });
+  tp.set_backend(thread_permuter::fiber);
+
+  double const estimate = tp.estimate_permutations(2000);
+  ASSERT(number_of_permutations == 0);          // Probes are not reported.
+  tp.run();
+  std::cout << "Estimated " << estimate << " permutations; there are " << number_of_permutations << "." << std::endl;
+  ASSERT(std::abs(estimate - number_of_permutations) < 0.2 * number_of_permutations);
+
+  // Four threads of five steps each have billions of permutations; a time budget of two seconds picks a limit.
+  ThreadPermuter::tests_type large_tests = { long_test, long_test, long_test, long_test };
+  int limited_permutations = 0;
+  ThreadPermuter tp2([]{}, large_tests, [&](std::string const&){ ++limited_permutations; });
+  tp2.set_backend(thread_permuter::fiber);
+  tp2.set_time_budget(std::chrono::seconds(2));
+  tp2.set_progress(std::chrono::seconds(1));
+  auto const start = std::chrono::steady_clock::now();
+  tp2.run();
+  std::chrono::duration<double> const duration = std::chrono::steady_clock::now() - start;
+  std::cout << "Played " << limited_permutations << " permutations in " << duration.count() << " seconds." << std::endl;
+  ASSERT(limited_permutations > 0 && duration.count() < 10);
+}
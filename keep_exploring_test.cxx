@@ -0,0 +1,129 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <iostream>
+#include <stdexcept>
+
+// Three different bugs: two assertions in the test functions and an exception.
+// A fourth failure is detected in on_permutation_end.
+struct TestRun
+{
+  int m_state;
+  int m_total;
+  int m_number_of_permutations = 0;
+
+  void on_permutation_begin() { m_state = 0; m_total = 0; }
+  void on_permutation_end()
+  {
+    ++m_number_of_permutations;
+    TP_ASSERT(m_total != 3);
+  }
+};
+
+void test0(TestRun& test_run)
+{
+  test_run.m_state = 1;
+  TPY;
+  test_run.m_state = 0;
+  TPY;
+  int total = test_run.m_total;
+  TPY;
+  test_run.m_total = total + 1;
+}
+
+void test1(TestRun& test_run)
+{
+  TPY;
+  TP_ASSERT(test_run.m_state == 0);
+  TPY;
+  int total = test_run.m_total;
+  TPY;
+  test_run.m_total = total + 2;
+}
+
+void test2(TestRun& test_run)
+{
+  TPY;
+  if (test_run.m_state == 1)
+    throw std::runtime_error("state is 1");
+  TPY;
+  TP_ASSERT(test_run.m_total != 1);
+}
+
+// A failure while a Mutex is locked.
+struct LockedTestRun
+{
+  thread_permuter::Mutex m_mutex;
+  int x;
+  int m_number_of_permutations = 0;
+};
+
+void locked_test(LockedTestRun& test_run, int n)
+{
+  test_run.m_mutex.lock();
+  TPY;
+  test_run.x = n == 0 ? test_run.x + 1 : 2 * test_run.x;
+  TP_ASSERT(test_run.x != 2);
+  TPY;
+  test_run.m_mutex.unlock();
+}
+
+// The Mutex must be unlocked when a test function fails, or the other threads can't finish
+// and the next permutation starts with it locked.
+void test_failure_with_mutex_locked()
+{
+  LockedTestRun test_run;
+  ThreadPermuter::tests_type tests =
+  {
+    [&test_run]{ locked_test(test_run, 0); },
+    [&test_run]{ locked_test(test_run, 1); }
+  };
+  ThreadPermuter tp(
+      [&]{ test_run.x = 1; },
+      tests,
+      [&](std::string const&){ ++test_run.m_number_of_permutations; });
+  tp.set_backend(thread_permuter::fiber);
+  tp.set_keep_exploring(true);
+  tp.run();
+
+  std::cout << "With a locked mutex: " << tp.number_of_permutations() << " permutations." << std::endl;
+  ASSERT(tp.failures().size() == 1);
+  ASSERT(test_run.m_number_of_permutations == tp.number_of_permutations());
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  test_failure_with_mutex_locked();
+
+  TestRun test_run;
+  ThreadPermuter::tests_type tests =
+  {
+    [&test_run]{ test0(test_run); },
+    [&test_run]{ test1(test_run); },
+    [&test_run]{ test2(test_run); }
+  };
+  ThreadPermuter tp(
+      [&]{ test_run.on_permutation_begin(); },
+      tests,
+      [&](std::string const&){ test_run.on_permutation_end(); });
+  tp.set_backend(thread_permuter::fiber);
+  tp.set_keep_exploring(true);
+  tp.run();
+
+  int number_of_failing_permutations = 0;
+  for (ThreadPermuter::Failure const& failure : tp.failures())
+  {
+    std::cout << '"' << failure.m_message << "\" in " << failure.m_file << ':' << failure.m_line << ": " <<
+      failure.m_count << " times, for example \"" << failure.m_permutation << "\"." << std::endl;
+    number_of_failing_permutations += failure.m_count;
+  }
+  std::cout << tp.number_of_permutations() << " permutations, of which " << number_of_failing_permutations << " failed." << std::endl;
+
+  // Every bug is found, once.
+  ASSERT(tp.failures().size() == 4);
+  // Exploration continued after the failures.
+  ASSERT(number_of_failing_permutations < tp.number_of_permutations());
+  ASSERT(test_run.m_number_of_permutations == tp.number_of_permutations());
+}
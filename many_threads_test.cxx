@@ -0,0 +1,55 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <utility>
+#include <vector>
+
+// Every thread appends its index to a shared vector.
+// With more than 32 threads this needs cmake -DTHREADPERMUTER_MAX_THREADS=<number of threads>.
+struct TestRun
+{
+  std::vector<int> m_order;
+  std::set<std::pair<int, int>> m_first_two;
+  int m_number_of_permutations = 0;
+
+  void on_permutation_begin() { m_order.clear(); }
+  void on_permutation_end(thread_permuter::ScheduleView schedule)
+  {
+    // The schedule is the order in which the threads ran.
+    ASSERT(schedule.size() == static_cast<int>(m_order.size()));
+    for (int si = 0; si < schedule.size(); ++si)
+      ASSERT(schedule[si].get_value() == static_cast<size_t>(m_order[si]));
+    m_first_two.emplace(m_order[0], m_order[1]);
+    ++m_number_of_permutations;
+  }
+};
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  int const number_of_threads = std::min(thread_permuter::max_threads, 80);
+
+  TestRun test_run;
+
+  ThreadPermuter::tests_type tests;
+  for (int n = 0; n < number_of_threads; ++n)
+    tests.push_back([&test_run, n]{ test_run.m_order.push_back(n); });
+
+  ThreadPermuter tp(
+      [&]{ test_run.on_permutation_begin(); },
+      tests,
+      [&](thread_permuter::ScheduleView schedule){ test_run.on_permutation_end(schedule); });
+
+  // Only vary which threads run first and second.
+  tp.set_limit(2);
+  tp.set_backend(thread_permuter::fiber);
+  tp.run();
+
+  std::cout << number_of_threads << " threads: " << test_run.m_number_of_permutations << " permutations." << std::endl;
+  ASSERT(test_run.m_number_of_permutations == number_of_threads * (number_of_threads - 1));
+  ASSERT(test_run.m_first_two.size() == static_cast<size_t>(test_run.m_number_of_permutations));
+}
@@ -0,0 +1,69 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "Minimizer.h"
+#include <iostream>
+
+// A bug that needs a single context switch: thread 1 must check the state between the two writes of thread 0.
+// Each thread does many more steps, so that a permutation that happens to find it is long.
+int state;
+
+void work()
+{
+  for (int i = 0; i < 8; ++i)
+    TPY;
+}
+
+void test0()
+{
+  work();
+  state = 1;
+  TPY;
+  state = 0;
+  TPY;
+}
+
+void test1()
+{
+  work();
+  TP_ASSERT(state == 0);
+  TPY;
+}
+
+// Threads beyond 'Z' are written as "{n}", which is still a single step.
+void test_wide_steps()
+{
+  using thread_permuter::Minimizer;
+  ASSERT(Minimizer::steps_of("{62}0{255}").size() == 3);
+  ASSERT(Minimizer::str(Minimizer::steps_of("{62}0{255}")) == "{62}0{255}");
+  ASSERT(Minimizer::context_switches("{62}{62}{62}") == 0);
+  ASSERT(Minimizer::context_switches("{62}{63}0{63}") == 3);
+  // Fewer context switches, then fewer steps.
+  ASSERT(Minimizer::simpler("{62}{62}0", "{62}0{62}"));
+  ASSERT(Minimizer::simpler("{62}0", "{62}{62}0"));
+  ASSERT(!Minimizer::simpler("{62}{62}0", "{62}0"));
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  test_wide_steps();
+
+  ThreadPermuter::tests_type tests = { test0, test1, work };
+  ThreadPermuter tp([]{ state = 0; }, tests, [](std::string const&){});
+  tp.set_backend(thread_permuter::fiber);
+
+  // Round robin fails too, but has a context switch at every step.
+  std::string failing_permutation;
+  for (int i = 0; i < 9; ++i)
+    failing_permutation += "012";
+  std::string const minimized_permutation = tp.minimize(failing_permutation);
+  std::cout << "Minimized \"" << failing_permutation << "\" to \"" << minimized_permutation << "\"." << std::endl;
+
+  // Thread 0 runs until it set the state, then thread 1 runs until it fails.
+  ASSERT(minimized_permutation == "000000000111111111");
+  ASSERT(thread_permuter::Minimizer::context_switches(minimized_permutation) == 1);
+  // Nothing simpler fails.
+  ASSERT(tp.minimize(minimized_permutation) == minimized_permutation);
+}
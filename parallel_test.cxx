@@ -0,0 +1,38 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "PermuteFixture.h"
+#include <iostream>
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  // Some permutations fail.
+  PermuteFixture fixture;
+  fixture.m_fail_on_zero = true;
+
+  ThreadPermuter tp(
+      [&]{ fixture.on_permutation_begin(); },
+      fixture.tests(),
+      [&](std::string const& permutation_string){ fixture.on_permutation_end(permutation_string); });
+
+  tp.set_backend(thread_permuter::fiber);
+  tp.set_keep_exploring(true);
+  tp.set_max_minimize_replays(0);
+
+  // Count the permutations and the failures of a serial run.
+  tp.run();
+  int const serial = tp.number_of_permutations();
+  ASSERT(tp.failures().size() == 1);
+  int const serial_failures = tp.failures()[0].m_count;
+
+  // Let three forked workers explore the same tree; every worker plays one permutation of
+  // each prefix that it doesn't own, but must only count and report those that it does own.
+  tp.run_parallel(3, 4);
+
+  std::cout << "Serial: " << serial << " permutations, " << serial_failures << " failed; parallel: " <<
+    tp.number_of_permutations() << " permutations, " << tp.number_of_failures() << " failed." << std::endl;
+  ASSERT(tp.number_of_permutations() == serial);
+  ASSERT(tp.number_of_failures() == serial_failures);
+}
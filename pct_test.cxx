@@ -0,0 +1,87 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <iostream>
+
+// A bug of depth 2: thread 1 must check the state between the two writes of thread 0.
+// Each thread does many more steps, so that exhaustively exploring all permutations is not an option.
+struct TestRun
+{
+  int m_state;
+  bool m_bad;
+  int m_number_of_runs = 0;
+  std::string m_failing_permutation;
+
+  void on_permutation_begin() { m_state = 0; m_bad = false; }
+  void on_permutation_end(std::string const& permutation_string)
+  {
+    ++m_number_of_runs;
+    if (m_bad && m_failing_permutation.empty())
+      m_failing_permutation = permutation_string;
+  }
+};
+
+void work()
+{
+  for (int i = 0; i < 8; ++i)
+    TPY;
+}
+
+void test0(TestRun& test_run)
+{
+  work();
+  test_run.m_state = 1;
+  TPY;
+  test_run.m_state = 0;
+  TPY;
+}
+
+void test1(TestRun& test_run)
+{
+  work();
+  // Normally one would use TP_ASSERT here.
+  if (test_run.m_state != 0)
+    test_run.m_bad = true;
+  TPY;
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  TestRun test_run;
+
+  ThreadPermuter::tests_type tests =
+  {
+    [&test_run]{ test0(test_run); },
+    [&test_run]{ test1(test_run); },
+    [&]{ work(); }
+  };
+
+  ThreadPermuter tp(
+      [&]{ test_run.on_permutation_begin(); },
+      tests,
+      [&](std::string const& permutation_string){ test_run.on_permutation_end(permutation_string); });
+
+  // Use a fixed seed so that the test is reproducible.
+  tp.run_pct(1000, 2, 12345);
+  std::cout << "Played " << test_run.m_number_of_runs << " permutations." << std::endl;
+  ASSERT(!test_run.m_failing_permutation.empty());
+  std::cout << "First failing permutation: " << test_run.m_failing_permutation << std::endl;
+
+  // The failing permutation can be replayed.
+  tp.run(test_run.m_failing_permutation);
+  ASSERT(test_run.m_bad);
+
+  // A failure of the run with the default schedule, that estimates the number of steps, is reported like any other.
+  int number_of_runs = 0;
+  ThreadPermuter::tests_type failing_tests =
+  {
+    []{ TPY; TP_ASSERT(false); },
+    []{ work(); }
+  };
+  ThreadPermuter failing_tp([]{}, failing_tests, [&](std::string const&){ ++number_of_runs; });
+  failing_tp.set_backend(thread_permuter::fiber);
+  failing_tp.run_pct(3, 2, 12345);
+  ASSERT(number_of_runs == 4);
+}
@@ -0,0 +1,110 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <set>
+#include <vector>
+#include <iostream>
+
+// Each thread adds its index to a shared total, with a few steps in between.
+struct TestRun
+{
+  int m_total;
+  int m_state;
+  bool m_bad;
+  std::vector<std::string> m_permutations;
+  std::string m_failing_permutation;
+
+  void on_permutation_begin() { m_total = 0; m_state = 0; m_bad = false; }
+  void on_permutation_end(std::string const& permutation_string)
+  {
+    m_permutations.push_back(permutation_string);
+    if (m_bad && m_failing_permutation.empty())
+      m_failing_permutation = permutation_string;
+  }
+};
+
+void add(TestRun& test_run, int n)
+{
+  TPY;
+  int total = test_run.m_total;
+  TPY;
+  test_run.m_total = total + n;
+  TPY;
+}
+
+// A bug that needs one preemption: thread 1 must check the state between the two writes of thread 0.
+void write_state(TestRun& test_run)
+{
+  for (int i = 0; i < 6; ++i)
+    TPY;
+  test_run.m_state = 1;
+  TPY;
+  test_run.m_state = 0;
+  TPY;
+}
+
+void check_state(TestRun& test_run)
+{
+  for (int i = 0; i < 6; ++i)
+    TPY;
+  // Normally one would use TP_ASSERT here.
+  if (test_run.m_state != 0)
+    test_run.m_bad = true;
+  TPY;
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  // Without a practical bound, iterative context bounding must play every permutation exactly once.
+  std::vector<std::string> permutations[2];
+  for (int bounded = 0; bounded < 2; ++bounded)
+  {
+    TestRun test_run;
+
+    ThreadPermuter::tests_type tests =
+    {
+      [&test_run]{ add(test_run, 1); },
+      [&test_run]{ add(test_run, 2); },
+      [&test_run]{ add(test_run, 3); }
+    };
+
+    ThreadPermuter tp(
+        [&]{ test_run.on_permutation_begin(); },
+        tests,
+        [&](std::string const& permutation_string){ test_run.on_permutation_end(permutation_string); });
+
+    if (bounded)
+      tp.set_max_preemptions(100);
+    tp.run();
+
+    permutations[bounded] = test_run.m_permutations;
+  }
+  std::set<std::string> exhaustive(permutations[0].begin(), permutations[0].end());
+  std::set<std::string> bounded(permutations[1].begin(), permutations[1].end());
+  std::cout << "Exhaustive: " << permutations[0].size() << " permutations; bounded: " << permutations[1].size() << " permutations." << std::endl;
+  ASSERT(bounded.size() == permutations[1].size());
+  ASSERT(bounded == exhaustive);
+
+  // A single preemption is enough to find the bug.
+  TestRun test_run;
+
+  ThreadPermuter::tests_type tests =
+  {
+    [&test_run]{ write_state(test_run); },
+    [&test_run]{ check_state(test_run); }
+  };
+
+  ThreadPermuter tp(
+      [&]{ test_run.on_permutation_begin(); },
+      tests,
+      [&](std::string const& permutation_string){ test_run.on_permutation_end(permutation_string); });
+
+  tp.set_max_preemptions(1);
+  tp.run();
+
+  std::cout << "With at most one preemption: " << test_run.m_permutations.size() << " permutations; the bug was found by \"" <<
+    test_run.m_failing_permutation << "\"." << std::endl;
+  ASSERT(!test_run.m_failing_permutation.empty());
+}
@@ -0,0 +1,158 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "PermuteFixture.h"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// The fixture, in a process that can crash.
+struct TestRun : PermuteFixture
+{
+  std::vector<std::string> m_permutations;
+  std::ofstream* m_log = nullptr;       // If set, every permutation is also written here.
+  int m_crash_after = -1;               // If non-negative, exit the process when this many permutations were played.
+
+  void on_permutation_end(std::string const& permutation_string)
+  {
+    if (m_crash_after == static_cast<int>(m_permutations.size()))
+      _exit(1);
+    m_permutations.push_back(permutation_string);
+    if (m_log)
+      *m_log << permutation_string << std::endl;
+  }
+};
+
+// Explore all permutations. If path is not empty, save the state of the search to it every permutation and crash
+// after crash_after permutations, or resume from it when crash_after is negative. The played permutations are then
+// also appended to path + ".log". Returns the permutations that were played.
+std::vector<std::string> explore(bool dpor, std::string const& path, int crash_after)
+{
+  TestRun test_run;
+  test_run.m_crash_after = crash_after;
+
+  ThreadPermuter tp(
+      [&]{ test_run.on_permutation_begin(); },
+      test_run.tests(),
+      [&](std::string const& permutation_string){ test_run.on_permutation_end(permutation_string); });
+
+  tp.set_backend(thread_permuter::fiber);
+  tp.set_dpor(dpor);
+  if (path.empty())
+    tp.run();
+  else
+  {
+    std::ofstream log(path + ".log", std::ios::app);
+    test_run.m_log = &log;
+    if (crash_after < 0)
+      tp.resume(path);
+    else
+    {
+      tp.set_search_state_file(path, std::chrono::seconds(0));
+      tp.run();
+    }
+  }
+  return test_run.m_permutations;
+}
+
+int main(int argc, char* argv[])
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  // The resumed search runs in a new process (see below).
+  if (argc == 4 && std::string(argv[1]) == "--resume")
+  {
+    explore(std::string(argv[3]) == "1", argv[2], -1);
+    return 0;
+  }
+
+  std::string const path = "/tmp/resume_test." + std::to_string(getpid());
+
+  for (int dpor = 0; dpor < 2; ++dpor)
+  {
+    std::vector<std::string> const expected = explore(dpor, {}, -1);
+    int const crash_after = expected.size() / 2;
+
+    // Crash half way.
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      explore(dpor, path, crash_after);
+      _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+
+    // Continue where it left off, in a process that was exec-ed like after a real crash;
+    // the objects of the test are then at different addresses than when the state was saved.
+    auto resume = [&]{
+      std::cout.flush();
+      pid_t pid = fork();
+      if (pid == 0)
+      {
+        execl("/proc/self/exe", argv[0], "--resume", path.c_str(), dpor ? "1" : "0", static_cast<char*>(nullptr));
+        _exit(2);
+      }
+      int status;
+      waitpid(pid, &status, 0);
+      return status;
+    };
+
+    // A damaged file must be rejected, not read out of bounds.
+    std::string header, search_state;
+    {
+      std::ifstream file(path, std::ios::binary);
+      std::getline(file, header);
+      search_state.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    ASSERT(std::stoul(header.substr(header.rfind(' ') + 1)) == search_state.size());
+    std::string const header_without_size = header.substr(0, header.rfind(' ') + 1);
+    // The header starts with the magic (four words), THREADPERMUTER_MAX_THREADS and the size of a set of threads.
+    size_t width_begin = 0;
+    for (int field = 0; field < 5; ++field)
+      width_begin = header.find(' ', width_begin) + 1;
+    size_t const width_end = header.find(' ', width_begin);
+    std::string const other_width = header.substr(0, width_begin) + "1" + header.substr(width_end);
+    std::vector<std::string> const damaged =
+    {
+      other_width + '\n' + search_state,                                                // Written by another build.
+      header + '\n' + search_state.substr(0, search_state.size() - 1),                  // Truncated.
+      header_without_size + "3\n" + search_state.substr(0, 3),                          // Too short for the first field.
+      header_without_size + std::to_string(search_state.size() + 1) + '\n' + search_state + 'x',       // Trailing bytes.
+      header_without_size + std::to_string(search_state.size()) + '\n' + std::string(search_state.size(), '\xff')  // Garbage.
+    };
+    for (std::string const& contents : damaged)
+    {
+      std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+      status = resume();
+      ASSERT(WIFSIGNALED(status));
+    }
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << header << '\n' << search_state;
+
+    status = resume();
+    ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // Read what was done before the crash and after resuming.
+    std::vector<std::string> permutations;
+    std::ifstream log(path + ".log");
+    std::string line;
+    while (std::getline(log, line))
+      permutations.push_back(line);
+    std::remove((path + ".log").c_str());
+
+    std::cout << (dpor ? "DPOR" : "Exhaustive") << ": " << expected.size() << " permutations; " <<
+      crash_after << " before the crash and " << (permutations.size() - crash_after) << " after resuming." << std::endl;
+    // Every permutation must be played exactly once.
+    ASSERT(permutations == expected);
+    // The file is removed when the search finished.
+    ASSERT(access(path.c_str(), F_OK) == -1);
+  }
+}
@@ -0,0 +1,139 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using thread_permuter::Schedule;
+using thread_permuter::ScheduleView;
+
+// Converting a view to a string allocates memory, so that may not happen implicitly.
+static_assert(!std::is_convertible_v<ScheduleView, std::string>);
+
+// Push values onto a Schedule for number_of_threads threads and read them back.
+void test_packing(int number_of_threads, std::vector<int> const& values)
+{
+  Schedule schedule(number_of_threads);
+  for (int value : values)
+    schedule.push_back(ThreadIndex(value));
+  ASSERT(schedule.size() == static_cast<int>(values.size()));
+  for (size_t si = 0; si < values.size(); ++si)
+    ASSERT(schedule[si].get_value() == static_cast<size_t>(values[si]));
+
+  // clear() keeps the buffer; the old steps may not leak into the new ones.
+  schedule.clear();
+  ASSERT(schedule.empty());
+  for (size_t si = 0; si < values.size(); ++si)
+    schedule.push_back(ThreadIndex(values[si] == 0 ? 1 : 0));
+  for (size_t si = 0; si < values.size(); ++si)
+    ASSERT(schedule[si].get_value() == (values[si] == 0 ? 1u : 0u));
+}
+
+// Convert a schedule to a permutation string and back.
+void test_round_trip(int number_of_threads, std::vector<int> const& values, std::string const& expected)
+{
+  Schedule schedule(number_of_threads);
+  for (int value : values)
+    schedule.push_back(ThreadIndex(value));
+  ASSERT(schedule.str() == expected);
+
+  Schedule parsed(number_of_threads);
+  parsed.assign(expected);
+  ASSERT(parsed.size() == static_cast<int>(values.size()));
+  for (size_t si = 0; si < values.size(); ++si)
+    ASSERT(parsed[si].get_value() == static_cast<size_t>(values[si]));
+
+  // The same, one thread index at a time.
+  size_t pos = 0;
+  for (int value : values)
+    ASSERT(thread_permuter::extract_thi(expected, pos).get_value() == static_cast<size_t>(value));
+  ASSERT(pos == expected.size());
+}
+
+void test_characters()
+{
+  ASSERT(thread_permuter::thi_to_char(ThreadIndex(0)) == '0');
+  ASSERT(thread_permuter::thi_to_char(ThreadIndex(10)) == 'a');
+  ASSERT(thread_permuter::thi_to_char(ThreadIndex(36)) == 'A');
+  ASSERT(thread_permuter::thi_to_char(ThreadIndex(61)) == 'Z');
+  // Beyond 'Z' there is no character.
+  ASSERT(thread_permuter::thi_to_char(ThreadIndex(62)) == '?');
+  for (size_t value = 0; value < 62; ++value)
+    ASSERT(thread_permuter::char_to_thi(thread_permuter::thi_to_char(ThreadIndex(value))).get_value() == value);
+}
+
+void test_view()
+{
+  Schedule schedule(4);
+  schedule.assign("01230123012301230123");
+  ScheduleView view(schedule);
+  ASSERT(view.size() == 20);
+  ASSERT(view.str() == "01230123012301230123");
+  ASSERT(static_cast<std::string>(view.first(3)) == "012");
+  ASSERT(view.first(0).empty());
+  ASSERT(view.first(5)[4].get_value() == 0);
+
+  // copy_to overwrites the string, and reuses its memory when it is large enough.
+  std::string permutation_string;
+  view.copy_to(permutation_string);
+  char const* const buffer = permutation_string.data();
+  view.first(2).copy_to(permutation_string);
+  ASSERT(permutation_string == "01");
+  ASSERT(permutation_string.data() == buffer);
+}
+
+// Playing a permutation string (see Permutation::program) must record the same permutation.
+// Every thread has a single step, so the permutation is the order in which the threads ran.
+void test_program()
+{
+  int const number_of_threads = std::min(thread_permuter::max_threads, 80);
+
+  std::vector<int> order;
+  ThreadPermuter::tests_type tests;
+  for (int n = 0; n < number_of_threads; ++n)
+    tests.push_back([&order, n]{ order.push_back(n); });
+
+  // Run the threads in reverse order; beyond 62 threads that uses "{n}".
+  std::string permutation;
+  for (int n = number_of_threads - 1; n >= 0; --n)
+    thread_permuter::append_thi(permutation, ThreadIndex(n));
+
+  std::string played;
+  ThreadPermuter tp(
+      [&]{ order.clear(); },
+      tests,
+      [&](std::string const& permutation_string){ played = permutation_string; });
+  tp.set_backend(thread_permuter::fiber);
+  tp.run(permutation);
+
+  ASSERT(played == permutation);
+  ASSERT(static_cast<int>(order.size()) == number_of_threads);
+  for (int n = 0; n < number_of_threads; ++n)
+    ASSERT(order[n] == number_of_threads - 1 - n);
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  // Up to 16 threads two steps share a byte.
+  test_packing(16, { 15, 0, 0, 15, 7, 8, 1 });
+  test_packing(2, { 1, 0, 1, 1, 0 });
+  // From 17 threads on every step uses a byte.
+  test_packing(17, { 16, 0, 255, 15, 200, 1, 17 });
+  test_packing(256, { 255, 254, 0, 128 });
+
+  test_round_trip(16, { 0, 9, 10, 15, 3 }, "09af3");
+  test_round_trip(100, { 5, 61, 62, 99, 36 }, "5Z{62}{99}A");
+  test_round_trip(256, { 255, 0, 255 }, "{255}0{255}");
+  test_round_trip(3, {}, "");
+
+  test_characters();
+  test_view();
+  test_program();
+
+  std::cout << "Success" << std::endl;
+}
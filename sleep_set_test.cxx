@@ -0,0 +1,28 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "PermuteFixture.h"
+#include <iostream>
+
+// Thread 2 of the fixture first changes y while holding another mutex. That step is
+// independent of those of the other threads, so sleep sets don't need to try them in every order.
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::vector<Exploration> const explorations = explore_modes({ "Exhaustive", "Sleep sets" },
+      [](int sleep_sets, PermuteFixture& fixture){
+        fixture.m_independent_step = true;
+        ThreadPermuter tp(
+            [&]{ fixture.on_permutation_begin(); },
+            fixture.tests(),
+            [&](std::string const& permutation_string){ fixture.on_permutation_end(permutation_string); });
+        tp.set_backend(thread_permuter::fiber);
+        tp.set_sleep_sets(sleep_sets);
+        tp.run();
+      });
+
+  // Sleep sets must find every result that the exhaustive search found, with fewer permutations.
+  ASSERT(explorations[0].m_results == explorations[1].m_results);
+  ASSERT(explorations[1].m_number_of_permutations < explorations[0].m_number_of_permutations);
+}
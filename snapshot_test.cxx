@@ -0,0 +1,84 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <sys/mman.h>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+
+// With snapshots, on_permutation_end is called in child processes; so store the results in shared memory.
+struct Results
+{
+  int m_number_of_permutations;
+  int m_histogram[64];
+};
+
+struct TestRun
+{
+  unsigned int x;
+  Results* m_results;
+
+  void on_permutation_begin() { x = 1; }
+  void on_permutation_end(std::string const& /*permutation_string*/)
+  {
+    ++m_results->m_number_of_permutations;
+    ++m_results->m_histogram[x & 63];
+  }
+};
+
+// Snapshots only pay off when replaying a step is expensive.
+void expensive_step()
+{
+  auto const end = std::chrono::steady_clock::now() + std::chrono::microseconds(500);
+  while (std::chrono::steady_clock::now() < end)
+    ;
+}
+
+void test(TestRun& test_run, unsigned int n)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    expensive_step();
+    test_run.x = 3 * test_run.x + n;
+    TPY;
+  }
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  void* shared = mmap(nullptr, 2 * sizeof(Results), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  ASSERT(shared != MAP_FAILED);
+  Results* results = static_cast<Results*>(shared);
+  std::memset(results, 0, 2 * sizeof(Results));
+
+  TestRun test_run;
+
+  ThreadPermuter::tests_type tests =
+  {
+    [&test_run]{ test(test_run, 1); },
+    [&test_run]{ test(test_run, 2); }
+  };
+
+  ThreadPermuter tp(
+      [&]{ test_run.on_permutation_begin(); },
+      tests,
+      [&](std::string const& permutation_string){ test_run.on_permutation_end(permutation_string); });
+  tp.set_backend(thread_permuter::fiber);
+
+  // Explore the same tree without and with snapshots.
+  for (int run = 0; run < 2; ++run)
+  {
+    test_run.m_results = &results[run];
+    tp.set_snapshots(run == 0 ? 0 : 16);
+    auto start = std::chrono::steady_clock::now();
+    tp.run();
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    std::cout << (run == 0 ? "Replaying" : "Snapshots") << ": " << results[run].m_number_of_permutations <<
+      " permutations in " << duration.count() << " seconds." << std::endl;
+  }
+
+  ASSERT(results[0].m_number_of_permutations == results[1].m_number_of_permutations);
+  ASSERT(std::memcmp(results[0].m_histogram, results[1].m_histogram, sizeof(results[0].m_histogram)) == 0);
+}
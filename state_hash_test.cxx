@@ -0,0 +1,125 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "VisitedStates.h"
+#include <set>
+#include <iostream>
+
+// Every thread updates x twice while holding m_mutex. The result depends on the order,
+// but because x is taken modulo 5 many different orders lead to the same state.
+struct TestRun
+{
+  thread_permuter::Mutex m_mutex;
+  int x;
+  int m_rounds[3];                      // The number of updates done by each thread.
+  int m_number_of_permutations;
+  std::set<int> m_results;
+
+  void on_permutation_begin();
+  void on_permutation_end(std::string const& permutation_string);
+  uint64_t state_hash() const;
+
+  void test(int n);
+};
+
+void TestRun::on_permutation_begin()
+{
+  DoutEntering(dc::notice|flush_cf, "on_permutation_begin()");
+  x = 1;
+  for (int n = 0; n < 3; ++n)
+    m_rounds[n] = 0;
+}
+
+void TestRun::on_permutation_end(std::string const& permutation_string)
+{
+  DoutEntering(dc::notice|flush_cf, "on_permutation_end(\"" << permutation_string << "\")");
+  Dout(dc::notice|flush_cf, "Result: " << x);
+  m_results.insert(x);
+  ++m_number_of_permutations;
+}
+
+// The loop counter of test() is the only local state that matters; it is kept in m_rounds.
+uint64_t TestRun::state_hash() const
+{
+  return x + 5 * (m_rounds[0] + 3 * (m_rounds[1] + 3 * m_rounds[2]));
+}
+
+void TestRun::test(int n)
+{
+  for (int round = 0; round < 2; ++round)
+  {
+    m_mutex.lock();
+    x = (3 * x + n + 1) % 5;
+    ++m_rounds[n];
+    m_mutex.unlock();
+    TPY;
+  }
+}
+
+// Keys that collide in the table of VisitedStates must still be told apart.
+void test_collisions()
+{
+  thread_permuter::VisitedStates visited_states;
+  // Zero marks an unused entry of the table, and these all start probing at the same entry.
+  uint64_t const keys[] = { 0, 1, 1024 + 1, 2 * 1024 + 1, uint64_t{1} << 32 | 1 };
+  for (uint64_t key : keys)
+    ASSERT(!visited_states.visit(key, 5));
+  for (uint64_t key : keys)
+  {
+    ASSERT(visited_states.visit(key, 5));
+    ASSERT(visited_states.visit(key, 6));
+    // Reaching a state closer to the root means its subtree wasn't explored yet.
+    ASSERT(!visited_states.visit(key, 4));
+    ASSERT(visited_states.visit(key, 4));
+  }
+  ASSERT(visited_states.size() == std::size(keys));
+  // Force the table to grow a few times; every key must still be found.
+  for (uint64_t key = 2; key < 10000; ++key)
+    visited_states.visit(key * 1024 + 1, 7);
+  for (uint64_t key : keys)
+    ASSERT(visited_states.visit(key, 4));
+  for (uint64_t key = 2; key < 10000; ++key)
+    ASSERT(visited_states.visit(key * 1024 + 1, 7));
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  test_collisions();
+
+  std::set<int> results[2];
+  int number_of_permutations[2];
+
+  for (int hashed = 0; hashed < 2; ++hashed)
+  {
+    TestRun test_run;
+    test_run.m_number_of_permutations = 0;
+
+    ThreadPermuter::tests_type tests =
+    {
+      [&test_run]{ test_run.test(0); },
+      [&test_run]{ test_run.test(1); },
+      [&test_run]{ test_run.test(2); }
+    };
+
+    ThreadPermuter tp(
+        [&]{ test_run.on_permutation_begin(); },
+        tests,
+        [&](std::string const& permutation_string){ test_run.on_permutation_end(permutation_string); });
+
+    tp.set_backend(thread_permuter::fiber);
+    if (hashed)
+      tp.set_state_hash([&test_run]{ return test_run.state_hash(); });
+    tp.run();
+
+    results[hashed] = test_run.m_results;
+    number_of_permutations[hashed] = test_run.m_number_of_permutations;
+  }
+
+  std::cout << "Exhaustive: " << number_of_permutations[0] << " permutations, " << results[0].size() << " different results." << std::endl;
+  std::cout << "State hash: " << number_of_permutations[1] << " permutations, " << results[1].size() << " different results." << std::endl;
+  // Pruning visited states must not lose any result.
+  ASSERT(results[0] == results[1]);
+  ASSERT(number_of_permutations[1] < number_of_permutations[0]);
+}
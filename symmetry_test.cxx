@@ -0,0 +1,92 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+// Three identical readers look at a value twice while a writer changes it twice.
+// Because the readers are indistinguishable, the result is the sorted list of what they saw.
+struct TestRun
+{
+  int m_value;
+  std::vector<int> m_seen;
+  int m_number_of_permutations = 0;
+  bool m_canonical = true;              // Set to false when a reader started before a reader with a lower index.
+  std::set<std::vector<int>> m_results;
+
+  void on_permutation_begin()
+  {
+    m_value = 0;
+    m_seen.clear();
+  }
+
+  void on_permutation_end(std::string const& permutation)
+  {
+    std::vector<int> result = m_seen;
+    std::sort(result.begin(), result.end());
+    m_results.insert(result);
+    ++m_number_of_permutations;
+    size_t const first1 = permutation.find('1');
+    size_t const first2 = permutation.find('2');
+    if (!(permutation.find('0') < first1 && first1 < first2))
+      m_canonical = false;
+  }
+
+  void reader()
+  {
+    int first = m_value;
+    TPY;
+    int second = m_value;
+    TPY;
+    m_seen.push_back(10 * first + second);
+  }
+
+  void writer()
+  {
+    m_value = 1;
+    TPY;
+    m_value = 2;
+    TPY;
+  }
+};
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::set<std::vector<int>> results[2];
+  int number_of_permutations[2];
+
+  for (int symmetry = 0; symmetry < 2; ++symmetry)
+  {
+    TestRun test_run;
+    ThreadPermuter::tests_type tests =
+    {
+      [&]{ test_run.reader(); },
+      [&]{ test_run.reader(); },
+      [&]{ test_run.reader(); },
+      [&]{ test_run.writer(); }
+    };
+    ThreadPermuter tp(
+        [&]{ test_run.on_permutation_begin(); },
+        tests,
+        [&](std::string const& permutation){ test_run.on_permutation_end(permutation); });
+    tp.set_backend(thread_permuter::fiber);
+    if (symmetry)
+      tp.set_symmetry_classes({ 0, 0, 0, 1 });
+    tp.run();
+
+    results[symmetry] = test_run.m_results;
+    number_of_permutations[symmetry] = test_run.m_number_of_permutations;
+    // With symmetry reduction only the permutations in which the readers start in order are played.
+    ASSERT(!symmetry || test_run.m_canonical);
+  }
+
+  std::cout << "Exhaustive: " << number_of_permutations[0] << " permutations, " << results[0].size() << " different results." << std::endl;
+  std::cout << "Symmetry: " << number_of_permutations[1] << " permutations, " << results[1].size() << " different results." << std::endl;
+  // Nothing is lost, and the three identical readers save a factor of (almost) 3! = 6.
+  ASSERT(results[0] == results[1]);
+  ASSERT(number_of_permutations[1] * 5 < number_of_permutations[0]);
+}
@@ -0,0 +1,86 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include "TestRunner.h"
+#include <iostream>
+#include <algorithm>
+
+// Scenarios are registered with TP_TEST and TP_TEST_SWEEP; a program that only consists of
+// those would use TP_MAIN. This test runs them itself to check the results.
+
+namespace {
+
+// Two threads add to a counter without a lock; the lost update is only a failure when checked.
+struct Counter
+{
+  int m_value;
+  bool m_check;
+
+  void add()
+  {
+    int value = m_value;
+    TPY;
+    m_value = value + 1;
+  }
+
+  void run(int number_of_threads)
+  {
+    ThreadPermuter::tests_type tests;
+    for (int t = 0; t < number_of_threads; ++t)
+      tests.push_back([this]{ add(); });
+    ThreadPermuter tp([this]{ m_value = 0; }, tests, [this, number_of_threads](std::string const&){ ASSERT(!m_check || m_value == number_of_threads); });
+    tp.set_backend(thread_permuter::fiber);
+    tp.run();
+  }
+};
+
+} // namespace
+
+TP_TEST(single_thread)
+{
+  Counter counter{0, true};
+  counter.run(1);
+}
+
+// Like the B(started, empty) combinations of FuzzyLock_test: bit 0 and 1 of the parameter are two settings.
+TP_TEST_SWEEP(sweep, 0, 1, 2, 3)
+{
+  Counter counter{0, false};
+  counter.run(2 + (parameter & 1) + (parameter >> 1));
+}
+
+TP_TEST(lost_update)
+{
+  Counter counter{0, true};
+  counter.run(2);
+}
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  std::vector<std::string> names;
+  for (thread_permuter::TestCase const& test : thread_permuter::registered_tests())
+    names.push_back(test.m_name);
+  ASSERT((names == std::vector<std::string>{ "single_thread", "sweep(0)", "sweep(1)", "sweep(2)", "sweep(3)", "lost_update" }));
+
+  int finished = 0;
+  std::vector<thread_permuter::TestResult> results = thread_permuter::run_tests({}, 4, [&](thread_permuter::TestResult const&){ ++finished; });
+  for (thread_permuter::TestResult const& result : results)
+    std::cout << result.m_name << ": " << result.m_status << ", " << result.m_permutations << " permutations." << std::endl;
+  ASSERT(finished == 6 && results.size() == 6);
+  // The results are in the order of registration, no matter which test finished first.
+  for (size_t i = 0; i < results.size(); ++i)
+    ASSERT(results[i].m_name == names[i]);
+  // Only the lost update fails; it aborted its own process, not this one.
+  for (size_t i = 0; i < results.size() - 1; ++i)
+    ASSERT(results[i].m_passed && results[i].m_permutations > 0);
+  ASSERT(!results.back().m_passed && results.back().m_status.find("signal") == 0);
+  // A sweep with three threads has more permutations than one with two.
+  ASSERT(results[1].m_permutations < results[2].m_permutations && results[2].m_permutations == results[3].m_permutations);
+
+  // Filters select tests by (part of) their name.
+  results = thread_permuter::run_tests({ "sweep(" }, 2);
+  ASSERT(results.size() == 4);
+  std::cout << "Success." << std::endl;
+}
@@ -0,0 +1,76 @@
+#include "sys.h"
+#include "debug.h"
+#include "ThreadPermuter.h"
+#include <iostream>
+#include <chrono>
+#include <set>
+#include <mutex>
+#include <pthread.h>
+
+// Many small ThreadPermuter objects, one per scenario, that share the threads of a pool.
+struct TestRun
+{
+  int m_value;
+  int m_number_of_permutations = 0;
+  std::set<pthread_t> m_threads;        // The threads that ran a test function.
+  size_t m_stack_size = 0;              // The smallest stack size of those.
+
+  void on_permutation_begin() { m_value = 0; }
+  void on_permutation_end(std::string const&) { ++m_number_of_permutations; }
+
+  void test(int n)
+  {
+    // Only one test function runs at a time, so this doesn't need a lock.
+    pthread_t const self = pthread_self();
+    if (m_threads.insert(self).second)
+    {
+      pthread_attr_t attr;
+      size_t stack_size;
+      pthread_getattr_np(self, &attr);
+      pthread_attr_getstacksize(&attr, &stack_size);
+      pthread_attr_destroy(&attr);
+      if (m_stack_size == 0 || stack_size < m_stack_size)
+        m_stack_size = stack_size;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+      int value = m_value;
+      TPY;
+      m_value = value + 1;
+    }
+  }
+};
+
+int main()
+{
+  Debug(NAMESPACE_DEBUG::init());
+
+  constexpr size_t stack_size = 128 * 1024;
+  thread_permuter::ThreadPool pool(stack_size);
+  TestRun test_run;
+  auto start = std::chrono::steady_clock::now();
+  int number_of_scenarios = 0;
+  for (thread_permuter::backend_type backend : { thread_permuter::os_thread, thread_permuter::futex })
+  {
+    for (int number_of_threads = 1; number_of_threads <= 3; ++number_of_threads)
+      for (int steps = 1; steps <= 2; ++steps)
+      {
+        ThreadPermuter::tests_type tests;
+        for (int t = 0; t < number_of_threads; ++t)
+          tests.push_back([&test_run, steps]{ test_run.test(steps); });
+        ThreadPermuter tp([&]{ test_run.on_permutation_begin(); }, tests, [&](std::string const& permutation){ test_run.on_permutation_end(permutation); });
+        tp.set_backend(backend);
+        tp.set_thread_pool(pool);
+        tp.run();
+        ++number_of_scenarios;
+      }
+  }
+  std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+  std::cout << number_of_scenarios << " scenarios (" << test_run.m_number_of_permutations << " permutations) in " << duration.count() <<
+    " seconds, using " << pool.size() << " threads with a stack of " << test_run.m_stack_size << " bytes." << std::endl;
+
+  // No more threads were created than a single scenario needed.
+  ASSERT(pool.size() == 3);
+  ASSERT(test_run.m_threads.size() == 3);
+  ASSERT(test_run.m_stack_size >= stack_size && test_run.m_stack_size < 2 * stack_size);
+}